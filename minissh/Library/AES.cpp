@@ -185,11 +185,9 @@ private:
     }
     
 public:
-    State(Types::Blob input)
+    State(const Byte *input)
     {
-        if (input.Length() != sizeof(_matrix))
-            throw std::runtime_error("Invalid state");
-        memcpy(_matrix, input.Value(), sizeof(_matrix));
+        memcpy(_matrix, input, sizeof(_matrix));
     }
     
     void SubBytes(bool encrypt)
@@ -205,7 +203,7 @@ public:
             ShiftRow(y, y, encrypt);
     }
     
-    void AddRoundKey(Types::Blob key, int offset)
+    void AddRoundKey(const Types::Blob& key, int offset)
     {
         offset *= sizeof(_matrix);
         if ((key.Length() - offset) < sizeof(_matrix))
@@ -222,9 +220,9 @@ public:
             DoMatrixMultiPart(_matrix + i, data);
     }
     
-    Types::Blob Data(void)
+    void CopyTo(Byte *output)
     {
-        return Types::Blob(_matrix, sizeof(_matrix));
+        memcpy(output, _matrix, sizeof(_matrix));
     }
 };
 
@@ -331,36 +329,44 @@ AES::AES(Types::Blob key)
     _expandedKey = ExpandKey(key, _rounds);
 }
 
-Types::Blob AES::Encrypt(Types::Blob data)
+void AES::EncryptInPlace(Byte *data, size_t length)
 {
-    State state(data);
-    state.AddRoundKey(_expandedKey, 0);
-    for (int roundCount = 1; roundCount < _rounds; roundCount++) {
+    if (length % BlockSize)
+        throw std::invalid_argument("Data is not a whole number of blocks");
+    for (Byte *block = data; block < (data + length); block += BlockSize) {
+        State state(block);
+        state.AddRoundKey(_expandedKey, 0);
+        for (int roundCount = 1; roundCount < _rounds; roundCount++) {
+            state.SubBytes(true);
+            state.ShiftRows(true);
+            state.MixColumns(true);
+            state.AddRoundKey(_expandedKey, roundCount);
+        }
         state.SubBytes(true);
         state.ShiftRows(true);
-        state.MixColumns(true);
-        state.AddRoundKey(_expandedKey, roundCount);
+        state.AddRoundKey(_expandedKey, _rounds);
+        state.CopyTo(block);
     }
-    state.SubBytes(true);
-    state.ShiftRows(true);
-    state.AddRoundKey(_expandedKey, _rounds);
-    return state.Data();
 }
 
-Types::Blob AES::Decrypt(Types::Blob data)
+void AES::DecryptInPlace(Byte *data, size_t length)
 {
-    State state(data);
-    state.AddRoundKey(_expandedKey, _rounds);
-    for (int roundCount = _rounds - 1; roundCount > 0; roundCount--) {
+    if (length % BlockSize)
+        throw std::invalid_argument("Data is not a whole number of blocks");
+    for (Byte *block = data; block < (data + length); block += BlockSize) {
+        State state(block);
+        state.AddRoundKey(_expandedKey, _rounds);
+        for (int roundCount = _rounds - 1; roundCount > 0; roundCount--) {
+            state.ShiftRows(false);
+            state.SubBytes(false);
+            state.AddRoundKey(_expandedKey, roundCount);
+            state.MixColumns(false);
+        }
         state.ShiftRows(false);
         state.SubBytes(false);
-        state.AddRoundKey(_expandedKey, roundCount);
-        state.MixColumns(false);
+        state.AddRoundKey(_expandedKey, 0);
+        state.CopyTo(block);
     }
-    state.ShiftRows(false);
-    state.SubBytes(false);
-    state.AddRoundKey(_expandedKey, 0);
-    return state.Data();
 }
 
 } // namespace minissh::Algorithm
@@ -18,10 +18,12 @@ namespace minissh::Algorithm {
 class AES : public AEncryption
 {
 public:
+    static constexpr int BlockSize = 16;
+    
     AES(Types::Blob key);
 
-    Types::Blob Encrypt(Types::Blob data);
-    Types::Blob Decrypt(Types::Blob data);
+    void EncryptInPlace(Byte *data, size_t length) override;
+    void DecryptInPlace(Byte *data, size_t length) override;
     
 private:
     int _rounds;
@@ -18,32 +18,30 @@ namespace {
     
 Maths::BigNumber GenerateN(int bits, Maths::IRandomSource &source)
 {
-    Maths::BigNumber p = Maths::Primes::GetPrime(source, bits / 2);
-    Maths::BigNumber q = Maths::Primes::GetPrime(source, bits / 2);
-    while (p == q)
-        q = Maths::Primes::GetPrime(source, bits);
-    return p * q;
+    std::vector<Maths::BigNumber> primes = Maths::Primes::GetPrimes(source, bits / 2, 2);
+    while (primes[0] == primes[1])
+        primes[1] = Maths::Primes::GetPrime(source, bits / 2);
+    return primes[0] * primes[1];
 }
 
 } // namespace
 
 BlumBlumShub::BlumBlumShub(int bits, IRandomSource &source)
+:_state(0), _n(GenerateN(bits, source))
 {
-    _n = GenerateN(bits, source);
-    _state = NULL;
 }
 
 void BlumBlumShub::SetSeed(Byte *bytes, UInt32 length)
 {
-    Maths::BigNumber(bytes, length).Divide(_n, _state);
+    _n.Reduce(Maths::BigNumber(bytes, length), _state);
 }
 
 UInt32 BlumBlumShub::Random(void)
 {
     UInt32 result = 0;
     for (int i = (sizeof(UInt32) * 8); i != 0; i--) {
-        _state = _state.PowerMod(2, _n);
-        result = (result << 1) | (_state[0] ? 1 : 0);
+        _n.SquareMod(_state, _state);
+        result = (result << 1) | (_state.TestBit(0) ? 1 : 0);
     }
     return result;
 }
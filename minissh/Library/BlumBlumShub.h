@@ -25,7 +25,7 @@ public:
     
 private:
     Maths::BigNumber _state;
-    Maths::BigNumber _n;
+    Maths::Barrett _n;  // Reduction context for the modulus, which is fixed once generated
 };
 
 } // namespace minissh::Random
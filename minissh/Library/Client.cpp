@@ -50,7 +50,7 @@ namespace {
                 RequestNext();
         }
         
-        void HandlePayload(Types::Blob data) override
+        void HandlePayload(const Types::Blob& data) override
         {
             Types::Reader reader(data);
             if (reader.ReadByte() != SERVICE_ACCEPT)
@@ -64,7 +64,7 @@ private:
 class PendingData : public APending
 {
 public:
-    PendingData(Connection::AChannel::IPending::Root& root, Types::Blob data)
+    PendingData(Connection::AChannel::IPending::Root& root, const Types::Blob& data)
     :APending(root), _data(data)
     {
     }
@@ -73,7 +73,7 @@ public:
     {
         if (maximum == 0)
             return 0;
-        Types::Blob packet;
+        Transport::OutgoingPacket packet(sender);
         Types::Writer writer(packet);
         writer.Write(Byte(CHANNEL_DATA));
         writer.Write(remoteChannel);
@@ -107,7 +107,7 @@ protected:
 class PendingExtendedData : public PendingData
 {
 public:
-    PendingExtendedData(Connection::AChannel::IPending::Root& root, UInt32 type, Types::Blob data)
+    PendingExtendedData(Connection::AChannel::IPending::Root& root, UInt32 type, const Types::Blob& data)
     :PendingData(root, data), _type(type)
     {
     }
@@ -116,7 +116,7 @@ public:
     {
         if (maximum == 0)
             return 0;
-        Types::Blob packet;
+        Transport::OutgoingPacket packet(sender);
         Types::Writer writer(packet);
         writer.Write(Byte(CHANNEL_EXTENDED_DATA));
         writer.Write(remoteChannel);
@@ -148,7 +148,7 @@ public:
 
     UInt32 Send(Transport::Transport& sender, UInt32 remoteChannel, UInt32 maximum) override
     {
-        Types::Blob packet;
+        Transport::OutgoingPacket packet(sender);
         Types::Writer writer(packet);
         writer.Write(Byte(CHANNEL_EOF));
         writer.Write(remoteChannel);
@@ -214,7 +214,7 @@ Connection::AChannel::~AChannel()
         delete _pendings.start;
 }
     
-void Connection::AChannel::Send(Types::Blob data)
+void Connection::AChannel::Send(const Types::Blob& data)
 {
     if (_sentEOF) {
         // error?
@@ -224,7 +224,7 @@ void Connection::AChannel::Send(Types::Blob data)
     CheckSend();
 }
 
-void Connection::AChannel::SendExtended(UInt32 type, Types::Blob data)
+void Connection::AChannel::SendExtended(UInt32 type, const Types::Blob& data)
 {
     if (_sentEOF) {
         // error?
@@ -247,7 +247,7 @@ void Connection::AChannel::SendEOF(void)
 void Connection::AChannel::Request(const std::string& request, bool wantResponse, std::optional<Types::Blob> extraData)
 {
     DEBUG_LOG_STATE(("Channel [remote %i] requesting '%s'\n", _remoteChannel, request.c_str()));
-    Types::Blob packet;
+    Transport::OutgoingPacket packet(_owner._transport);
     Types::Writer writer(packet);
     writer.Write(Byte(CHANNEL_REQUEST));
     writer.Write(_remoteChannel);
@@ -263,14 +263,14 @@ void Connection::AChannel::Close(void)
     if (_sentClose)
         return;
     _sentClose = true;
-    Types::Blob packet;
+    Transport::OutgoingPacket packet(_owner._transport);
     Types::Writer writer(packet);
     writer.Write(Byte(CHANNEL_CLOSE));
     writer.Write(_remoteChannel);
     _owner._transport.Send(packet);
 }
 
-void Connection::AChannel::HandleOpen(UInt32 otherChannel, UInt32 windowSize, UInt32 maxPacketSize, Types::Blob data)
+void Connection::AChannel::HandleOpen(UInt32 otherChannel, UInt32 windowSize, UInt32 maxPacketSize, const Types::Blob& data)
 {
     _remoteChannel = otherChannel;
     _remoteWindowSize = windowSize;
@@ -278,7 +278,7 @@ void Connection::AChannel::HandleOpen(UInt32 otherChannel, UInt32 windowSize, UI
     Opened(data);
 }
 
-void Connection::AChannel::HandleData(Types::Blob data)
+void Connection::AChannel::HandleData(const Types::Blob& data)
 {
     _localWindowSize -= data.Length();
     // TODO: check it's not gone negative
@@ -286,7 +286,7 @@ void Connection::AChannel::HandleData(Types::Blob data)
     ReceivedData(data);
 }
 
-void Connection::AChannel::HandleExtendedData(UInt32 type, Types::Blob data)
+void Connection::AChannel::HandleExtendedData(UInt32 type, const Types::Blob& data)
 {
     _localWindowSize -= data.Length();
     // TODO: check it's not gone negative
@@ -312,7 +312,7 @@ void Connection::AChannel::HandleRequest(const std::string& request, bool reply,
     DEBUG_LOG_STATE(("Channel [remote %i] received request '%s'\n", _remoteChannel, request.c_str()));
     bool result = ReceivedRequest(request, data);
     if (reply) {
-        Types::Blob packet;
+        Transport::OutgoingPacket packet(_owner._transport);
         Types::Writer writer(packet);
         writer.Write(Byte(result ? CHANNEL_SUCCESS : CHANNEL_FAILURE));
         writer.Write(_remoteChannel);
@@ -336,7 +336,7 @@ void Connection::AChannel::CheckSend(void)
 void Connection::AChannel::CheckWindow(void)
 {
     if (_localWindowSize < 16384) {
-        Types::Blob packet;
+        Transport::OutgoingPacket packet(_owner._transport);
         Types::Writer writer(packet);
         writer.Write(Byte(CHANNEL_WINDOW_ADJUST));
         writer.Write(_remoteChannel);
@@ -386,7 +386,7 @@ void Connection::SendChannelRequest(UInt32 channelIndex, std::shared_ptr<AChanne
     parameters.packetSize = 1024;
     parameters.windowSize = 65536;
     AChannel::OpenChannelInfo info = channel->OpenInfo(parameters);
-    Types::Blob packet;
+    Transport::OutgoingPacket packet(_transport);
     Types::Writer writer(packet);
     writer.Write(Byte(CHANNEL_OPEN));
     writer.WriteString(info.name);
@@ -408,7 +408,7 @@ void Connection::RegisterChannelType(std::string channelType, std::shared_ptr<IC
 
 void Connection::SendOpenFailure(UInt32 recipientChannel, SSHConnection reason)
 {
-    Types::Blob send;
+    Transport::OutgoingPacket send(_transport);
     Types::Writer writer(send);
     writer.Write((Byte)CHANNEL_OPEN_FAILURE);
     writer.Write(recipientChannel);
@@ -418,7 +418,7 @@ void Connection::SendOpenFailure(UInt32 recipientChannel, SSHConnection reason)
     _transport.Send(send);
 }
 
-void Connection::HandlePayload(Types::Blob packet)
+void Connection::HandlePayload(const Types::Blob& packet)
 {
     Types::Reader reader(packet);
     Byte message = reader.ReadByte();
@@ -443,7 +443,7 @@ void Connection::HandlePayload(Types::Blob packet)
                 } else {
                     UInt32 recipientChannel = _channels.Map(channel);
                     AChannel::OpenChannelInfo info = channel->OpenInfo(parameters);
-                    Types::Blob send;
+                    Transport::OutgoingPacket send(_transport);
                     Types::Writer writer(send);
                     writer.Write((Byte)CHANNEL_OPEN_CONFIRMATION);
                     writer.Write(senderChannel);
@@ -58,17 +58,17 @@ public:
 
         // Client and server hooks
         virtual OpenChannelInfo OpenInfo(OpenChannelParameters& parameters) = 0;
-        virtual void Opened(Types::Blob data) {};
+        virtual void Opened(const Types::Blob& data) {};
         virtual void ReceivedEOF(void) { /* Indicates the remote will send no further data */ }
         virtual void ReceivedClose(void) {};
-        virtual void ReceivedData(Types::Blob data) = 0;
-        virtual void ReceivedExtendedData(UInt32 type, Types::Blob data) = 0;
+        virtual void ReceivedData(const Types::Blob& data) = 0;
+        virtual void ReceivedExtendedData(UInt32 type, const Types::Blob& data) = 0;
         virtual bool ReceivedRequest(const std::string& request, std::optional<Types::Blob> data) { return false; }
         virtual void ReceivedRequestResponse(bool success) {}
 
         // API
-        void Send(Types::Blob data);
-        void SendExtended(UInt32 type, Types::Blob data);
+        void Send(const Types::Blob& data);
+        void SendExtended(UInt32 type, const Types::Blob& data);
         void SendEOF(void);
         void Request(const std::string& request, bool wantResponse, std::optional<Types::Blob> extraData);
         void Close(void);
@@ -76,9 +76,9 @@ public:
     private:
         friend Connection;
         
-        void HandleOpen(UInt32 otherChannel, UInt32 windowSize, UInt32 maxPacketSize, Types::Blob data);
-        void HandleData(Types::Blob data);
-        void HandleExtendedData(UInt32 type, Types::Blob data);
+        void HandleOpen(UInt32 otherChannel, UInt32 windowSize, UInt32 maxPacketSize, const Types::Blob& data);
+        void HandleData(const Types::Blob& data);
+        void HandleExtendedData(UInt32 type, const Types::Blob& data);
         void HandleWindowAdjust(UInt32 adjust);
         void HandleClose(void);
         void HandleRequest(const std::string& request, bool reply, std::optional<Types::Blob> data);
@@ -112,7 +112,7 @@ public:
     
     ~Connection();
     
-    void HandlePayload(Types::Blob data) override;
+    void HandlePayload(const Types::Blob& data) override;
 
     void OpenChannel(std::shared_ptr<AChannel> channel);  // Start an outgoing connection (other side is provider)
     
@@ -163,7 +163,7 @@ public:
     
     void ServiceRequested(std::string name, std::optional<std::string> username) override;
     
-    void HandlePayload(Types::Blob data) override { Connection::HandlePayload(data); }
+    void HandlePayload(const Types::Blob& data) override { Connection::HandlePayload(data); }
 };
 
 /**
@@ -176,7 +176,7 @@ public:
 
     void Start(void) override;
     
-    void HandlePayload(Types::Blob data) override { Connection::HandlePayload(data); }
+    void HandlePayload(const Types::Blob& data) override { Connection::HandlePayload(data); }
 };
 
 } // namespace minissh::Core::Connection
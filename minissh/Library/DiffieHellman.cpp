@@ -21,13 +21,18 @@ Hash::SHA1 hash;
     
 } // namespace
     
+Parameters::Parameters(const Maths::BigNumber& p, const Maths::BigNumber& g, int exponentBits)
+:p(p), g(g), exponentBits(exponentBits), field(p), generator(field, g, exponentBits)
+{
+}
+
 bool Base::CheckRange(const Maths::BigNumber &number)
 {
-    return (number >= 1) && (number <= (_p - 1));
+    return (number >= 1) && (number < _group->p);
 }
 
-Base::Base(Transport::Transport& owner, Transport::Mode mode, Maths::BigNumber p, Maths::BigNumber g)
-:KeyExchanger(owner, mode, hash), _p(p), _g(g)
+Base::Base(Transport::Transport& owner, Transport::Mode mode, std::shared_ptr<const Parameters> group)
+:KeyExchanger(owner, mode, hash), _group(group)
 {
     Byte message = (_mode == Transport::Server) ? KEXDH_INIT : KEXDH_REPLY;
     _owner.RegisterForPackets(this, &message, 1);
@@ -68,11 +73,12 @@ Types::Blob Base::MakeHash(void)
 
 void Base::Start(void)
 {
+    // The private exponent only needs to be as long as the group is strong, which also keeps this power short
     do {
-        _xy = Maths::BigNumber(_p.BitLength(), _owner.random);
+        _xy = Maths::BigNumber(_group->exponentBits, _owner.random);
     } while (!CheckRange(_xy));
     
-    Maths::BigNumber ef = _g.PowerMod(_xy, _p);
+    Maths::BigNumber ef = _group->generator.PowerMod(_xy);
     
     switch (_mode) {
         case Transport::Client:
@@ -91,7 +97,7 @@ void Base::Start(void)
     }
 }
 
-void Base::HandlePayload(Types::Blob data)
+void Base::HandlePayload(const Types::Blob& data)
 {
     Types::Reader reader(data);
     
@@ -106,7 +112,7 @@ void Base::HandlePayload(Types::Blob data)
             // Compute key
             if (!CheckRange(_e))
                 _owner.Panic(Transport::Transport::PanicReason::OutOfRange);
-            key = _e.PowerMod(_xy, _p);
+            key = _group->field.PowerMod(_e, _xy);
             // Calculate hash
             exchangeHash = MakeHash();
             if (!_owner.sessionID)
@@ -137,7 +143,7 @@ void Base::HandlePayload(Types::Blob data)
             // Compute key
             if (!CheckRange(_f))
                 _owner.Panic(Transport::Transport::PanicReason::OutOfRange);
-            key = _f.PowerMod(_xy, _p);
+            key = _group->field.PowerMod(_f, _xy);
             // Calculate hash
             exchangeHash = MakeHash();
             if (!_owner.sessionID)
@@ -213,11 +219,17 @@ const UInt32 diffieHellman_group1[] = {
     0xEE386BFB, 0x5A899FA5, 0xAE9F2411, 0x7C4B1FE6, 0x49286651, 0xECE65381,
     0xFFFFFFFF, 0xFFFFFFFF
 };
+
+std::shared_ptr<const Parameters> Group1Parameters(void)
+{
+    static const std::shared_ptr<const Parameters> parameters = std::make_shared<Parameters>(Maths::BigNumber(diffieHellman_group1, sizeof(diffieHellman_group1) / sizeof(diffieHellman_group1[0]), true), Maths::BigNumber(2), 160);
+    return parameters;
+}
     
 } // namespace
 
 Group1::Group1(Transport::Transport& owner, Transport::Mode mode)
-:Base(owner, mode, Maths::BigNumber(diffieHellman_group1, sizeof(diffieHellman_group1) / sizeof(diffieHellman_group1[0]), true), Maths::BigNumber(2))
+:Base(owner, mode, Group1Parameters())
 {
 }
 
@@ -237,10 +249,16 @@ const UInt32 diffieHellman_group14[] = {
     0x15728E5A, 0x8AACAA68, 0xFFFFFFFF, 0xFFFFFFFF
 };
 
+std::shared_ptr<const Parameters> Group14Parameters(void)
+{
+    static const std::shared_ptr<const Parameters> parameters = std::make_shared<Parameters>(Maths::BigNumber(diffieHellman_group14, sizeof(diffieHellman_group14) / sizeof(diffieHellman_group14[0]), true), Maths::BigNumber(2), 224);
+    return parameters;
+}
+
 } // namespace
     
 Group14::Group14(Transport::Transport& owner, Transport::Mode mode)
-:Base(owner, mode, Maths::BigNumber(diffieHellman_group14, sizeof(diffieHellman_group14) / sizeof(diffieHellman_group14[0]), true), Maths::BigNumber(2))
+:Base(owner, mode, Group14Parameters())
 {
 }
 
@@ -8,26 +8,42 @@
 
 #pragma once
 
+#include "Maths.h"
 #include "Transport.h"
 
 class LargeNumber;
 
 namespace minissh::Algorithms::DiffieHellman {
 
+/**
+ * The fixed values of a group, along with anything precomputed from them. These never change, so one instance is
+ * shared by every exchange using the group.
+ */
+class Parameters
+{
+public:
+    Parameters(const Maths::BigNumber& p, const Maths::BigNumber& g, int exponentBits);
+    
+    const Maths::BigNumber p, g;        // Prime and Generator
+    const int exponentBits;             // Private exponent length, twice the group's security level in bits
+    const Maths::Montgomery field;      // Reduction context for the prime
+    const Maths::FixedBase generator;   // Precomputed powers of the generator
+};
+
 class Base : public Transport::KeyExchanger
 {
 public:
-    Base(Transport::Transport& owner, Transport::Mode mode, Maths::BigNumber p, Maths::BigNumber g);
+    Base(Transport::Transport& owner, Transport::Mode mode, std::shared_ptr<const Parameters> group);
     
     void Start(void) override;
     
-    void HandlePayload(Types::Blob data) override;
+    void HandlePayload(const Types::Blob& data) override;
     
 protected:
     ~Base();
     
 private:
-    Maths::BigNumber _p, _g;    // Prime and Generator
+    std::shared_ptr<const Parameters> _group;
     
     Maths::BigNumber _xy;
 
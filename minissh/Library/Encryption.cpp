@@ -7,14 +7,47 @@ AEncryption::AEncryption(Types::Blob key)
 {
 }
 
+Types::Blob AEncryption::Encrypt(const Types::Blob& data)
+{
+    Types::Blob result(data.Value(), data.Length());
+    EncryptInPlace(result.MutableValue(), result.Length());
+    return result;
+}
+
+Types::Blob AEncryption::Decrypt(const Types::Blob& data)
+{
+    Types::Blob result(data.Value(), data.Length());
+    DecryptInPlace(result.MutableValue(), result.Length());
+    return result;
+}
+
 AOperation::AOperation(AEncryption& encryption, Types::Blob initialisationVector)
 :_encryption(encryption), _currentVector(initialisationVector)
 {
 }
 
-void AOperation::SetVector(Types::Blob vector)
+Types::Blob AOperation::Encrypt(const Types::Blob& data)
+{
+    Types::Blob result(data.Value(), data.Length());
+    EncryptInPlace(result.MutableValue(), result.Length());
+    return result;
+}
+
+Types::Blob AOperation::Decrypt(const Types::Blob& data)
+{
+    Types::Blob result(data.Value(), data.Length());
+    DecryptInPlace(result.MutableValue(), result.Length());
+    return result;
+}
+
+size_t AOperation::CheckLength(size_t length)
 {
-    _currentVector = vector;
+    size_t blockSize = _currentVector.Length();
+    if ((blockSize == 0) || (blockSize > MaximumBlockSize))
+        throw std::invalid_argument("Unsupported block size");
+    if (length % blockSize)
+        throw std::invalid_argument("Data is not a whole number of blocks");
+    return blockSize;
 }
 
 } // namespace minissh::Algorithm
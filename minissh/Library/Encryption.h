@@ -20,9 +20,15 @@ class AEncryption
 {
 public:
     AEncryption(Types::Blob key);
+    virtual ~AEncryption() = default;
     
-    virtual Types::Blob Encrypt(Types::Blob data) = 0;
-    virtual Types::Blob Decrypt(Types::Blob data) = 0;
+    // Encrypt or decrypt whole blocks in place, each independently of the others
+    virtual void EncryptInPlace(Byte *data, size_t length) = 0;
+    virtual void DecryptInPlace(Byte *data, size_t length) = 0;
+    
+    // Convenience wrappers, returning a processed copy of the data
+    Types::Blob Encrypt(const Types::Blob& data);
+    Types::Blob Decrypt(const Types::Blob& data);
     
 protected:
     
@@ -36,16 +42,23 @@ class AOperation
 {
 public:
     AOperation(AEncryption& encryption, Types::Blob initialisationVector);
+    virtual ~AOperation() = default;
+    
+    // Encrypt or decrypt a run of blocks in place, chaining them as per the mode of operation
+    virtual void EncryptInPlace(Byte *data, size_t length) = 0;
+    virtual void DecryptInPlace(Byte *data, size_t length) = 0;
     
-    virtual Types::Blob Encrypt(Types::Blob data) = 0;
-    virtual Types::Blob Decrypt(Types::Blob data) = 0;
+    // Convenience wrappers, returning a processed copy of the data
+    Types::Blob Encrypt(const Types::Blob& data);
+    Types::Blob Decrypt(const Types::Blob& data);
     
 protected:
+    static constexpr size_t MaximumBlockSize = 16;   // AES's, the largest any mode has to hold a copy of
     
     AEncryption& _encryption;
     Types::Blob _currentVector;
     
-    void SetVector(Types::Blob vector);
+    size_t CheckLength(size_t length);
 };
 
 } // namespace minissh::Algorithm
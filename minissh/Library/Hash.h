@@ -48,7 +48,7 @@ public:
         virtual void Update(const Byte *data, UInt32 length) = 0;
         virtual std::optional<Types::Blob> End(void) = 0;
 
-        void Update(Types::Blob blob)
+        void Update(const Types::Blob& blob)
         {
             Update(blob.Value(), blob.Length());
         }
@@ -61,7 +61,7 @@ public:
     virtual std::shared_ptr<AToken> Start(void) const = 0;
     virtual UInt64 DigestLength(void) const = 0;
 
-    std::optional<Types::Blob> Compute(Types::Blob data) const
+    std::optional<Types::Blob> Compute(const Types::Blob& data) const
     {
         std::shared_ptr<AToken> token = Start();
         token->Update(data);
@@ -9,58 +9,290 @@
 #include <stdlib.h>
 #include <memory.h>
 #include <stdio.h>
+#include <limits>
 #include "Maths.h"
 #include "Types.h"
+#include "SlidingWindow.h"
 
 namespace minissh::Maths {
 
 namespace {
     
-struct EuclideanGCD_Result {
-    BigNumber gcd, x, y;
-};
-    
-EuclideanGCD_Result EuclideanGCD(const BigNumber& a, const BigNumber& b)
+// Bits of the leading part that Lehmer's algorithm works on. Leaves room for the cofactors' signs and sums.
+constexpr int LehmerPrecision = 62;
+
+// A single precision cofactor from Lehmer's algorithm, as a BigNumber
+BigNumber Cofactor(long long value)
 {
-    if (a == 0)
-        return {b, 0, 1};
-    EuclideanGCD_Result result = EuclideanGCD(b % a, a);
-    return {result.gcd, result.y - (b / a) * result.x, result.x};
+    UInt64 magnitude = (value < 0) ? (UInt64(0) - UInt64(value)) : UInt64(value);
+    const UInt32 words[2] = {UInt32(magnitude), UInt32(magnitude >> 32)};
+    BigNumber result(words, 2);
+    return (value < 0) ? (BigNumber(0) - result) : result;
 }
 
-int nlz(unsigned x)
+BigNumber Absolute(const BigNumber& value)
 {
-    int n;
+    return (value < 0) ? (BigNumber(0) - value) : value;
+}
+
+// Digits that fit inside a BigNumber, for sizing working space to match
+constexpr UInt32 StackDigits = BIGNUMBER_INLINE_BITS / BIGNUMBER_DIGIT_BITS;
+
+// Working space kept on the stack by a calculation. It's capped at a couple of BigNumbers' worth, whatever the
+// operands, so that nested calls and big window tables don't run small stacks out; more than that goes on the heap.
+constexpr UInt32 ScratchInlineDigits = 2 * StackDigits;
+
+// Working space for a calculation, on the stack unless more than ScratchInlineDigits are needed
+template<class Digit> class ScratchDigits
+{
+public:
+    ScratchDigits(UInt32 count)
+    :_data((count > ScratchInlineDigits) ? new Digit[count] : _inline)
+    {
+    }
+    ~ScratchDigits()
+    {
+        if (_data != _inline)
+            delete[] _data;
+    }
+    ScratchDigits(const ScratchDigits&) = delete;
+    ScratchDigits& operator=(const ScratchDigits&) = delete;
+    
+    Digit* Data(void) { return _data; }
     
-    if (x == 0) return(32);
-    n = 0;
-    if (x <= 0x0000FFFF) {n = n +16; x = x <<16;}
-    if (x <= 0x00FFFFFF) {n = n + 8; x = x << 8;}
-    if (x <= 0x0FFFFFFF) {n = n + 4; x = x << 4;}
-    if (x <= 0x3FFFFFFF) {n = n + 2; x = x << 2;}
-    if (x <= 0x7FFFFFFF) {n = n + 1;}
+private:
+    Digit _inline[ScratchInlineDigits];
+    Digit *_data;
+};
+
+// Double width type, for holding the product of two digits
+template<class Digit> struct Wide;
+template<> struct Wide<UInt32> { typedef UInt64 Type; };
+#if BIGNUMBER_DIGIT_BITS == 64
+template<> struct Wide<UInt64> { typedef unsigned __int128 Type; };
+#endif
+
+constexpr UInt32 DefaultKaratsubaThreshold = (BIGNUMBER_DIGIT_BITS == 64) ? 24 : 32;
+UInt32 karatsubaThreshold = DefaultKaratsubaThreshold;  // In digits. Below this, schoolbook multiplication is quicker.
+
+template<class Digit> void SchoolbookMultiply(const Digit *a, UInt32 m, const Digit *b, UInt32 n, Digit *result)
+{
+    typedef typename Wide<Digit>::Type Double;
+    const int bits = sizeof(Digit) * 8;
+    memset(result, 0, sizeof(Digit) * (m + n));
+    for (UInt32 j = 0; j < n; j++) {
+        Digit k = 0;
+        for (UInt32 i = 0; i < m; i++) {
+            Double t = (Double(a[i]) * b[j]) + result[i + j] + k;
+            result[i + j] = Digit(t);
+            k = Digit(t >> bits);
+        }
+        result[j + m] = k;
+    }
+}
+
+// result += addend, over length digits, returning the carry out
+template<class Digit> Digit AddDigits(Digit *result, const Digit *addend, UInt32 length)
+{
+    typedef typename Wide<Digit>::Type Double;
+    Digit carry = 0;
+    for (UInt32 i = 0; i < length; i++) {
+        Double sum = Double(result[i]) + addend[i] + carry;
+        result[i] = Digit(sum);
+        carry = Digit(sum >> (sizeof(Digit) * 8));
+    }
+    return carry;
+}
+
+// result -= subtrahend, over length digits, returning the borrow out
+template<class Digit> Digit SubtractDigits(Digit *result, const Digit *subtrahend, UInt32 length)
+{
+    Digit borrow = 0;
+    for (UInt32 i = 0; i < length; i++) {
+        Digit value = result[i];
+        Digit difference = value - subtrahend[i] - borrow;
+        borrow = (value < subtrahend[i]) || ((value == subtrahend[i]) && borrow);
+        result[i] = difference;
+    }
+    return borrow;
+}
+
+// Ripple a carry (or borrow) along length digits, returning what's left over
+template<class Digit> Digit AddCarry(Digit *result, UInt32 length, Digit carry)
+{
+    for (UInt32 i = 0; carry && (i < length); i++)
+        carry = ++result[i] == 0;
+    return carry;
+}
+template<class Digit> Digit SubtractBorrow(Digit *result, UInt32 length, Digit borrow)
+{
+    for (UInt32 i = 0; borrow && (i < length); i++)
+        borrow = result[i]-- == 0;
+    return borrow;
+}
+
+// Scratch digits needed by Karatsuba for n digit operands
+UInt32 KaratsubaScratch(UInt32 n)
+{
+    if (n < karatsubaThreshold)
+        return 0;
+    UInt32 high = n - (n / 2);
+    return (4 * (high + 1)) + KaratsubaScratch(high + 1);
+}
+
+// Multiplies two n digit numbers into 2n digits of result: a0*b0 and a1*b1 go straight into the result, and the
+// middle term comes from (a0 + a1)(b0 + b1) less those, which is three half size multiplications instead of four.
+template<class Digit> void Karatsuba(const Digit *a, const Digit *b, UInt32 n, Digit *result, Digit *scratch)
+{
+    if (n < karatsubaThreshold) {
+        SchoolbookMultiply(a, n, b, n, result);
+        return;
+    }
+    UInt32 low = n / 2, high = n - low;
+    Digit *sumA = scratch;
+    Digit *sumB = sumA + high + 1;
+    Digit *middle = sumB + high + 1;
+    Digit *next = middle + (2 * (high + 1));
+    // Sums of the halves
+    memcpy(sumA, a + low, sizeof(Digit) * high);
+    sumA[high] = AddCarry(sumA + low, high - low, AddDigits(sumA, a, low));
+    memcpy(sumB, b + low, sizeof(Digit) * high);
+    sumB[high] = AddCarry(sumB + low, high - low, AddDigits(sumB, b, low));
+    // Products
+    Karatsuba(a, b, low, result, next);
+    Karatsuba(a + low, b + low, high, result + (2 * low), next);
+    Karatsuba(sumA, sumB, high + 1, middle, next);
+    // Middle term, added in at the split
+    UInt32 middleLength = 2 * (high + 1);
+    SubtractBorrow(middle + (2 * low), middleLength - (2 * low), SubtractDigits(middle, result, 2 * low));
+    SubtractBorrow(middle + (2 * high), middleLength - (2 * high), SubtractDigits(middle, result + (2 * low), 2 * high));
+    UInt32 length = std::min(middleLength, (2 * n) - low);
+    AddCarry(result + low + length, (2 * n) - low - length, AddDigits(result + low, middle, length));
+}
+
+// Full product of an m digit and an n digit number, into m + n digits of result
+template<class Digit> void LongMultiply(const Digit *a, UInt32 m, const Digit *b, UInt32 n, Digit *result)
+{
+    if (m < n) {
+        std::swap(a, b);
+        std::swap(m, n);
+    }
+    if (n < karatsubaThreshold) {
+        SchoolbookMultiply(a, m, b, n, result);
+        return;
+    }
+    // Multiply by the shorter operand a chunk at a time, adding each product in
+    UInt32 scratchSize = KaratsubaScratch(n);
+    ScratchDigits<Digit> scratch(scratchSize + (2 * n));
+    Digit *product = scratch.Data() + scratchSize;
+    memset(result, 0, sizeof(Digit) * (m + n));
+    for (UInt32 offset = 0; offset < m; offset += n) {
+        UInt32 length = std::min(n, m - offset);
+        if (length == n)
+            Karatsuba(a + offset, b, n, product, scratch.Data());
+        else
+            SchoolbookMultiply(b, n, a + offset, length, product);
+        AddDigits(result + offset, product, n + length);
+    }
+}
+
+// Square of an n digit number into 2n digits of result. Each cross product a[i]a[j] is the same as a[j]a[i], so it is
+// worked out once and doubled, then the squares of each digit are added along the diagonal.
+template<class Digit> void SchoolbookSquare(const Digit *a, UInt32 n, Digit *result)
+{
+    typedef typename Wide<Digit>::Type Double;
+    const int bits = sizeof(Digit) * 8;
+    memset(result, 0, sizeof(Digit) * (2 * n));
+    for (UInt32 i = 0; i < n; i++) {
+        Digit k = 0;
+        for (UInt32 j = i + 1; j < n; j++) {
+            Double t = (Double(a[i]) * a[j]) + result[i + j] + k;
+            result[i + j] = Digit(t);
+            k = Digit(t >> bits);
+        }
+        result[i + n] = k;
+    }
+    Digit carry = 0;
+    for (UInt32 i = 0; i < (2 * n); i++) {
+        Digit value = result[i];
+        result[i] = (value << 1) | carry;
+        carry = value >> (bits - 1);
+    }
+    carry = 0;
+    for (UInt32 i = 0; i < n; i++) {
+        Double t = (Double(a[i]) * a[i]) + result[2 * i] + carry;
+        result[2 * i] = Digit(t);
+        t = Double(result[(2 * i) + 1]) + (t >> bits);
+        result[(2 * i) + 1] = Digit(t);
+        carry = Digit(t >> bits);
+    }
+}
+
+// Karatsuba for squares: a0^2 and a1^2, with the middle term from (a0 + a1)^2 less those. Needs no more scratch than
+// Karatsuba multiplication.
+template<class Digit> void KaratsubaSquare(const Digit *a, UInt32 n, Digit *result, Digit *scratch)
+{
+    if (n < karatsubaThreshold) {
+        SchoolbookSquare(a, n, result);
+        return;
+    }
+    UInt32 low = n / 2, high = n - low;
+    Digit *sum = scratch;
+    Digit *middle = sum + high + 1;
+    Digit *next = middle + (2 * (high + 1));
+    memcpy(sum, a + low, sizeof(Digit) * high);
+    sum[high] = AddCarry(sum + low, high - low, AddDigits(sum, a, low));
+    KaratsubaSquare(a, low, result, next);
+    KaratsubaSquare(a + low, high, result + (2 * low), next);
+    KaratsubaSquare(sum, high + 1, middle, next);
+    UInt32 middleLength = 2 * (high + 1);
+    SubtractBorrow(middle + (2 * low), middleLength - (2 * low), SubtractDigits(middle, result, 2 * low));
+    SubtractBorrow(middle + (2 * high), middleLength - (2 * high), SubtractDigits(middle, result + (2 * low), 2 * high));
+    UInt32 length = std::min(middleLength, (2 * n) - low);
+    AddCarry(result + low + length, (2 * n) - low - length, AddDigits(result + low, middle, length));
+}
+
+// Number of leading zero bits in a digit
+template<class Digit> int nlz(Digit x)
+{
+    const int bits = sizeof(Digit) * 8;
+    if (x == 0)
+        return bits;
+    int n = 0;
+    for (int shift = bits / 2; shift != 0; shift /= 2) {
+        if (!(x >> (bits - shift))) {
+            n += shift;
+            x <<= shift;
+        }
+    }
     return n;
 }
 
+// Number of 32 bit words that fit in a digit
+constexpr UInt32 WordsPerDigit = BIGNUMBER_DIGIT_BITS / 32;
+
 }
     
 BigNumber::BigNumber()
+:_positive(true), _digits(_inline), _count(1), _capacity(InlineDigits)
 {
-    _count = 1;
-    _digits = new DigitType[1];
-    _positive = true;
     _digits[0] = 0;
 }
 
 BigNumber::BigNumber(const BigNumber &original)
+:BigNumber()
+{
+    *this = original;
+}
+
+BigNumber::BigNumber(BigNumber &&original)
+:BigNumber()
 {
-    _count = original._count;
-    _digits = new DigitType[_count];
-    memcpy(_digits, original._digits, _count * sizeof(DigitType));
-    _positive = original._positive;
+    *this = std::move(original);
 }
 
 BigNumber::BigNumber(int simpleValue)
+:BigNumber()
 {
     if (simpleValue < 0) {
         simpleValue = -simpleValue;
@@ -68,8 +300,7 @@ BigNumber::BigNumber(int simpleValue)
     } else {
         _positive = true;
     }
-    _count = (sizeof(simpleValue) + (sizeof(DigitType) - 1)) / sizeof(DigitType);
-    _digits = new DigitType[_count];
+    Expand((sizeof(simpleValue) + (sizeof(DigitType) - 1)) / sizeof(DigitType));
     _digits[_count - 1] = 0;
     const Byte *input = (Byte*)&simpleValue;
     Byte *output = (Byte*)_digits;
@@ -79,9 +310,10 @@ BigNumber::BigNumber(int simpleValue)
 }
 
 BigNumber::BigNumber(const void *bytes, UInt32 count, bool checkSign)
+:BigNumber()
 {
+    Reserve(((count + (sizeof(DigitType) - 1)) / sizeof(DigitType)) + 1);
     _count = (count + (sizeof(DigitType) - 1)) / sizeof(DigitType);
-    _digits = new DigitType[_count + 1];
     // _digits is LSB first, bytes is MSB first. bytes is 2's complement, _digits is not.
     Byte *output = (Byte*)_digits;
     const Byte *input = (Byte*)bytes;
@@ -100,44 +332,111 @@ BigNumber::BigNumber(const void *bytes, UInt32 count, bool checkSign)
 }
 
 BigNumber::BigNumber(const UInt32 *data, UInt32 count, bool reverse)
+:BigNumber()
 {
-    _count = count;
-    _positive = true;
-    _digits = new DigitType[_count];
-    if (reverse) {
-        for (int i = 0; i < count; i++)
-            _digits[count - (i + 1)] = data[i];
-    } else {
-        memcpy(_digits, data, count * sizeof(DigitType));
+    Expand((count + WordsPerDigit - 1) / WordsPerDigit);
+    for (UInt32 i = 0; i < count; i++) {
+        UInt32 word = reverse ? data[count - (i + 1)] : data[i];
+        _digits[i / WordsPerDigit] |= DigitType(word) << ((i % WordsPerDigit) * 32);
     }
     Compact();
 }
 
 BigNumber::BigNumber(UInt32 bits, IRandomSource &source)
+:BigNumber()
 {
-    _positive = true;
-    _count = (bits + (sizeof(DigitType) * 8) - 1) / (8 * sizeof(DigitType));
-    _digits = new DigitType[_count];
-    for (int i = 0; i < _count; i++)
-        _digits[i] = source.Random();
+    // Filled a 32 bit word at a time, so the same source gives the same number whatever the digit size
+    UInt32 words = std::max((bits + 31) / 32, 1u);
+    Expand((words + WordsPerDigit - 1) / WordsPerDigit);
+    for (UInt32 i = 0; i < words; i++)
+        _digits[i / WordsPerDigit] |= DigitType(source.Random()) << ((i % WordsPerDigit) * 32);
+    Compact();
 }
 
 BigNumber::~BigNumber()
 {
-    delete[] _digits;
+    if (_digits != _inline)
+        delete[] _digits;
 }
 
 BigNumber BigNumber::GCD(const BigNumber& b) const
 {
-    return EuclideanGCD(*this, b).gcd;
+    BigNumber u = Absolute(*this), v = Absolute(b);
+    if (u < v)
+        std::swap(u, v);
+    Lehmer(u, v, NULL, NULL);
+    return u;
 }
 
 BigNumber BigNumber::GCD(const BigNumber& b, BigNumber& x, BigNumber& y) const
 {
-    EuclideanGCD_Result result = EuclideanGCD(*this, b);
-    x = result.x;
-    y = result.y;
-    return result.gcd;
+    // Only the cofactor for this is tracked, and the other is worked out from it at the end
+    BigNumber a = Absolute(*this), u = a, v = Absolute(b), su = 1, sv = 0;
+    if (u < v) {
+        std::swap(u, v);
+        std::swap(su, sv);
+    }
+    Lehmer(u, v, &su, &sv);
+    x = _positive ? su : (BigNumber(0) - su);
+    if (b == 0) {
+        y = 0;
+    } else {
+        y = (u - (a * su)) / Absolute(b);
+        if (!b._positive)
+            y = BigNumber(0) - y;
+    }
+    return u;
+}
+
+void BigNumber::Lehmer(BigNumber &u, BigNumber &v, BigNumber *su, BigNumber *sv)
+{
+    // Euclid's algorithm, run until v is zero, leaving the GCD in u. u and v must be non-negative, with u >= v. If su
+    // and sv are given, they're cofactors updated alongside u and v.
+    // This is Lehmer's method (Knuth 4.5.2, algorithm L): as long as the quotients are certain to be the same, the
+    // steps are simulated on the leading bits alone in single precision, then applied to the full numbers at once.
+    while (v != 0) {
+        long long A = 1, B = 0, C = 0, D = 1;
+        int shift = u.BitLength() - LehmerPrecision;
+        if (shift > 0) {
+            long long uh = (long long)u.Bits(shift), vh = (long long)v.Bits(shift);
+            while (((vh + C) != 0) && ((vh + D) != 0)) {
+                long long q = (uh + A) / (vh + C);
+                if (q != ((uh + B) / (vh + D)))
+                    break;
+                long long t = A - (q * C);
+                A = C;
+                C = t;
+                t = B - (q * D);
+                B = D;
+                D = t;
+                t = uh - (q * vh);
+                uh = vh;
+                vh = t;
+            }
+        }
+        if (B == 0) {
+            // Nothing could be simulated, so take a single full step
+            BigNumber remainder;
+            BigNumber q = u.Divide(v, remainder);
+            u = std::move(v);
+            v = std::move(remainder);
+            if (su) {
+                BigNumber t = *su - (q * *sv);
+                *su = std::move(*sv);
+                *sv = std::move(t);
+            }
+        } else {
+            BigNumber a = Cofactor(A), b = Cofactor(B), c = Cofactor(C), d = Cofactor(D);
+            BigNumber t = (a * u) + (b * v);
+            v = (c * u) + (d * v);
+            u = std::move(t);
+            if (su) {
+                t = (a * *su) + (b * *sv);
+                *sv = (c * *su) + (d * *sv);
+                *su = std::move(t);
+            }
+        }
+    }
 }
 
 int BigNumber::Compare(const BigNumber &other) const
@@ -163,64 +462,70 @@ int BigNumber::Compare(const BigNumber &other) const
     }
 }
 
-void BigNumber::Expand(UInt32 size)
+void BigNumber::Reserve(UInt32 size)
 {
-    if (_count >= size)
+    if (_capacity >= size)
         return;
     DigitType *other = new DigitType[size];
     memcpy(other, _digits, sizeof(DigitType) * _count);
-    memset(other + _count, 0, sizeof(DigitType) * (size - _count));
-    _count = size;
-    delete[] _digits;
+    if (_digits != _inline)
+        delete[] _digits;
     _digits = other;
+    _capacity = size;
 }
 
-void BigNumber::Compact(void)
+void BigNumber::Expand(UInt32 size)
 {
-    UInt32 pos;
-    for (pos = _count - 1; (_digits[pos] == 0) && (pos != 0); pos--);
-    pos++;
-    if (pos == _count)
+    if (_count >= size)
         return;
-    DigitType *other = new DigitType[pos];
-    memcpy(other, _digits, sizeof(DigitType) * pos);
-    delete[] _digits;
-    _digits = other;
-    _count = pos;
+    Reserve(size);
+    memset(_digits + _count, 0, sizeof(DigitType) * (size - _count));
+    _count = size;
+}
+
+void BigNumber::Compact(void)
+{
+    // Only the length changes, the storage is kept for reuse
+    while ((_count > 1) && (_digits[_count - 1] == 0))
+        _count--;
 }
 
 void BigNumber::CheckSign(void)
 {
-    if (_digits[_count - 1] & (1 << ((sizeof(DigitType) * 8) - 1))) {
+    if (_digits[_count - 1] & (DigitType(1) << ((sizeof(DigitType) * 8) - 1))) {
         // Two's complement - invert
         for (int i = 0; i < _count; i++)
             _digits[i] = ~_digits[i];
         // Add an extra digit
-        DigitType *moreBytes = new DigitType[_count + 1];
-        memcpy(moreBytes, _digits, _count * sizeof(DigitType));
-        delete[] _digits;
-        _digits = moreBytes;
+        UInt32 count = _count;
+        Expand(count + 1);
         // Two's complement - add one
-        UInt64 carry = 1;
-        for (int i = 0; i < _count; i++) {
-            UInt64 chunk = UInt64(_digits[i]) + carry;
-            _digits[i] = chunk & ((UInt64(1) << (sizeof(DigitType) * 8)) - 1);
-            carry = chunk >> (sizeof(DigitType) * 8);
+        DigitType carry = 1;
+        for (UInt32 i = 0; i < count; i++) {
+            _digits[i] += carry;
+            carry = carry && (_digits[i] == 0);
         }
         // Finish off
-        _digits[_count] = DigitType(carry);
-        _count++;
+        _digits[count] = carry;
         _positive = !_positive;
     }
     Compact();
 }
 
-bool BigNumber::operator[](UInt32 bit) const
+bool BigNumber::TestBit(UInt32 bit) const
 {
-    int index = bit / sizeof(DigitType);
+    const UInt32 digitBits = sizeof(DigitType) * 8;
+    UInt32 index = bit / digitBits;
     if (index >= _count)
         return false;
-    return _digits[index] & (1 << (bit % sizeof(DigitType)));
+    return (_digits[index] >> (bit % digitBits)) & 1;
+}
+
+void BigNumber::SetBit(UInt32 bit)
+{
+    const UInt32 digitBits = sizeof(DigitType) * 8;
+    Expand((bit / digitBits) + 1);
+    _digits[bit / digitBits] |= DigitType(1) << (bit % digitBits);
 }
 
 BigNumber& BigNumber::operator&=(const BigNumber &rightSide)
@@ -252,51 +557,48 @@ BigNumber& BigNumber::operator^=(const BigNumber &rightSide)
     return *this;
 }
 
-// TODO: Optimise shifting methods, as they can very easily shift in multiples of sizeof(DigitType) before the last step of sub-size shifting
-
-BigNumber& BigNumber::operator>>=(const BigNumber &rightSide)
+BigNumber& BigNumber::operator>>=(int amount)
 {
-    BigNumber remains = rightSide;
-    while (remains != 0) {
-        int amount = sizeof(DigitType) * 8;
-        if (BigNumber(amount) > remains)
-            amount = remains.AsInt();
-        DigitType saved = 0;
-        for (int i = _count; i != 0; i--) {
-            DigitType value = _digits[i - 1];
-            DigitType nextSaved = value & UInt32((UInt64(1) << (amount + 1)) - 1);
-            _digits[i - 1] = (value >> amount) | (saved << ((sizeof(DigitType) * 8) - amount));
-            saved = nextSaved;
-        }
-        remains -= amount;
+    if (amount < 0)
+        return operator<<=(-amount);
+    // Whole digits move down, then the remaining bits are shifted across the digit boundaries
+    const UInt32 bits = sizeof(DigitType) * 8;
+    UInt32 words = UInt32(amount) / bits, shift = UInt32(amount) % bits;
+    if (words >= _count) {
+        _count = 1;
+        _digits[0] = 0;
+        _positive = true;
+        return *this;
     }
+    UInt32 count = _count - words;
+    for (UInt32 i = 0; i < count; i++) {
+        DigitType value = _digits[i + words] >> shift;
+        if (shift && ((i + 1) < count))
+            value |= _digits[i + words + 1] << (bits - shift);
+        _digits[i] = value;
+    }
+    _count = count;
     Compact();
     return *this;
 }
 
-BigNumber& BigNumber::operator<<=(const BigNumber &rightSide)
+BigNumber& BigNumber::operator<<=(int amount)
 {
-    int bitcount = sizeof(DigitType) * 8;
-    
-    BigNumber remains = rightSide;
-    
-    BigNumber extraCount = (remains + (sizeof(DigitType) * 8) - 1) / sizeof(DigitType);
-    Expand(_count + extraCount.AsInt());
-    
-    while (remains != 0) {
-        int amount = bitcount;
-        if (BigNumber(amount) > remains)
-            amount = remains.AsInt();
-        DigitType saved = 0;
-        int revshift = bitcount - amount;
-        for (int i = 0; i != _count; i++) {
-            DigitType value = _digits[i];
-            DigitType nextSaved = value & (((UInt64(1) << amount) - 1) << revshift);
-            _digits[i] = UInt32(UInt64(value) << amount) | (saved >> revshift);
-            saved = nextSaved;
-        }
-        remains -= amount;
+    if (amount < 0)
+        return operator>>=(-amount);
+    const UInt32 bits = sizeof(DigitType) * 8;
+    UInt32 words = UInt32(amount) / bits, shift = UInt32(amount) % bits;
+    UInt32 count = _count;
+    Expand(count + words + 1);
+    // Working down, so digits are read before anything is written over them
+    for (UInt32 i = count + words + 1; i-- > words;) {
+        UInt32 from = i - words;
+        DigitType value = (from < count) ? (_digits[from] << shift) : 0;
+        if (shift && (from != 0))
+            value |= _digits[from - 1] >> (bits - shift);
+        _digits[i] = value;
     }
+    memset(_digits, 0, sizeof(DigitType) * words);
     Compact();
     return *this;
 }
@@ -313,10 +615,10 @@ void BigNumber::Add(const BigNumber &other)
 {
     UInt32 n = std::max(_count, other._count);
     Expand(n + 1);
-    UInt64 k = 0; // Carry
+    DoubleDigitType k = 0; // Carry
     for (UInt32 j = 0; j < n; j++) {
-        UInt64 sum = UInt64((j < _count) ? _digits[j] : 0) + UInt64((j < other._count) ? other._digits[j] : 0) + k;
-        _digits[j] = DigitType(sum & ((UInt64(1) << (sizeof(DigitType) * 8)) - 1));
+        DoubleDigitType sum = DoubleDigitType((j < _count) ? _digits[j] : 0) + ((j < other._count) ? other._digits[j] : 0) + k;
+        _digits[j] = DigitType(sum);
         k = sum >> (sizeof(DigitType) * 8);
     }
     _digits[n] = DigitType(k);
@@ -327,34 +629,74 @@ void BigNumber::Subtract(const BigNumber &other)
 {
     UInt32 n = std::max(_count, other._count);
     Expand(n + 1);
-    UInt64 k = 0; // Carry
+    DigitType k = 0; // Borrow
     for (UInt32 j = 0; j < n; j++) {
-        UInt64 sum = UInt64((j < _count) ? _digits[j] : 0) - UInt64((j < other._count) ? other._digits[j] : 0) + (int)k;
-        _digits[j] = DigitType(sum & ((UInt64(1) << (sizeof(DigitType) * 8)) - 1));
-        k = sum >> (sizeof(DigitType) * 8);
+        DigitType a = (j < _count) ? _digits[j] : 0;
+        DigitType b = (j < other._count) ? other._digits[j] : 0;
+        _digits[j] = a - b - k;
+        k = (a < b) || ((a == b) && k);
     }
-    _digits[n] = DigitType(k);
+    _digits[n] = k ? ~DigitType(0) : 0;  // Sign extend, for CheckSign
     CheckSign();
 }
 
 void BigNumber::Multiply(const BigNumber &other)
 {
     UInt32 m = _count, n = other._count;
-    DigitType *result = new DigitType[m + n];
-    memset(result, 0, sizeof(DigitType) * (m + n));
-    for (int j = 0; j < n; j++) {
-        DigitType k = 0;
-        for (int i = 0; i < m; i++) {
-            UInt64 t = UInt64(_digits[i]) * UInt64(other._digits[j]) + result[i + j] + k;
-            result[i + j] = DigitType(t & ((UInt64(1) << (sizeof(DigitType) * 8)) - 1));
-            k = t >> (sizeof(DigitType) * 8);
-        }
-        result[j + m] = k;
+    BigNumber result;
+    result.Reserve(m + n);
+    LongMultiply(_digits, m, other._digits, n, result._digits);
+    result._count = m + n;
+    result.Compact();
+    result._positive = _positive;
+    *this = std::move(result);
+}
+
+void BigNumber::MulMod(const BigNumber &a, const BigNumber &b, const BigNumber &mod, BigNumber &result)
+{
+    BigNumber product;
+    product.Reserve(a._count + b._count);
+    LongMultiply(a._digits, a._count, b._digits, b._count, product._digits);
+    product._count = a._count + b._count;
+    product._positive = a._positive == b._positive;
+    product.Compact();
+    product._Divide(mod, &result);
+}
+
+void BigNumber::SquareMod(const BigNumber &a, const BigNumber &mod, BigNumber &result)
+{
+    a.Square()._Divide(mod, &result);
+}
+
+void BigNumber::AddMod(const BigNumber &a, const BigNumber &b, const BigNumber &mod, BigNumber &result)
+{
+    if (&result == &b) {
+        result += a;
+    } else {
+        result = a;
+        result += b;
     }
-    _count = m + n;
-    delete[] _digits;
-    _digits = result;
-    Compact();
+    // Reduced operands only ever need one subtraction
+    if (result >= mod) {
+        result -= mod;
+        if (result >= mod)
+            result %= mod;
+    }
+}
+
+BigNumber BigNumber::Square(void) const
+{
+    BigNumber result;
+    result.Reserve(_count * 2);
+    result._count = _count * 2;
+    if (_count < karatsubaThreshold) {
+        SchoolbookSquare(_digits, _count, result._digits);
+    } else {
+        ScratchDigits<DigitType> scratch(KaratsubaScratch(_count));
+        KaratsubaSquare(_digits, _count, result._digits, scratch.Data());
+    }
+    result.Compact();
+    return result;
 }
 
 void BigNumber::_Divide(const BigNumber &other, BigNumber *remainder)
@@ -362,7 +704,7 @@ void BigNumber::_Divide(const BigNumber &other, BigNumber *remainder)
     // Based on http://www.hackersdelight.org/hdcodetxt/divmnu.c.txt
     
     const UInt32 bs = sizeof(DigitType) * 8;
-    const UInt64 b = UInt64(1) << bs;
+    const DoubleDigitType b = DoubleDigitType(1) << bs;
     
     // Parameters
     UInt32 m = _count;
@@ -380,36 +722,33 @@ void BigNumber::_Divide(const BigNumber &other, BigNumber *remainder)
         return;
     }
     
-    // Allocate output values
-    DigitType *q = new DigitType[m - n + 1];
+    // Output values, built separately so that the remainder can be the divisor
+    BigNumber quotient, rest;
+    quotient.Expand(m - n + 1);
+    quotient._positive = _positive;
+    DigitType *q = quotient._digits;
     DigitType *r = NULL;
-    memset(q, 0, sizeof(DigitType) * (m - n + 1));
     if (remainder) {
-        r = new DigitType[n];
-        memset(r, 0, sizeof(DigitType) * n);
-        
-        delete[] remainder->_digits;
-        remainder->_digits = r;
-        remainder->_count = n;
-        remainder->_positive = _positive;   // % is remainder, not modulus, so sign should always follow us
+        rest.Expand(n);
+        rest._positive = _positive;   // % is remainder, not modulus, so sign should always follow us
+        r = rest._digits;
     }
     
     // Take care of single digit divisor here
     if (n == 1) {
-        UInt64 k = 0;
+        DoubleDigitType k = 0;
         for (int j = m - 1; j >= 0; j--) {
-            UInt64 t = k * b + u[j];
+            DoubleDigitType t = k * b + u[j];
             q[j] = (DigitType)(t / v[0]);
-            k = t - q[j] * v[0];
+            k = t - DoubleDigitType(q[j]) * v[0];
         }
         if (r != NULL) {
             r[0] = (DigitType)k;
-            remainder->Compact();
+            rest.Compact();
+            *remainder = std::move(rest);
         }
-        delete[] _digits;
-        _digits = q;
-        _count = m - n + 1;
-        Compact();
+        quotient.Compact();
+        *this = std::move(quotient);
         return;
     }
     
@@ -420,23 +759,24 @@ void BigNumber::_Divide(const BigNumber &other, BigNumber *remainder)
     
     UInt32 s = nlz(v[n - 1]);
     // shift v
-    DigitType *vn = new DigitType[n];
+    ScratchDigits<DigitType> working(n + m + 1);
+    DigitType *vn = working.Data();
     for (UInt32 i = n - 1; i != 0; i--)
-        vn[i] = UInt32((UInt64(v[i]) << s) | (UInt64(v[i - 1]) >> (bs - s)));
+        vn[i] = DigitType((DoubleDigitType(v[i]) << s) | (DoubleDigitType(v[i - 1]) >> (bs - s)));
     vn[0] = v[0] << s;
     // shift u
-    DigitType *un = new DigitType[m + 1];
-    un[m] = UInt32(UInt64(u[m - 1]) >> (bs - s));
+    DigitType *un = vn + n;
+    un[m] = DigitType(DoubleDigitType(u[m - 1]) >> (bs - s));
     for (UInt32 i = m - 1; i != 0; i--)
-        un[i] = UInt32((UInt64(u[i]) << s) | (UInt64(u[i - 1]) >> (bs - s)));
+        un[i] = DigitType((DoubleDigitType(u[i]) << s) | (DoubleDigitType(u[i - 1]) >> (bs - s)));
     un[0] = u[0] << s;
     
     for (int j = m - n; j >= 0; j--) {
         // Compute estimate
-        UInt64 temp = un[j + n] * b + un[j + n - 1];
+        DoubleDigitType temp = un[j + n] * b + un[j + n - 1];
         DigitType vnn1 = vn[n - 1];
-        UInt64 qhat = temp / vnn1;
-        UInt64 rhat = temp - qhat * vnn1;
+        DoubleDigitType qhat = temp / vnn1;
+        DoubleDigitType rhat = temp - qhat * vnn1;
     again:
         if (qhat >= b || qhat*vn[n-2] > b*rhat + un[j+n-2]) {
             qhat -= 1;
@@ -446,12 +786,12 @@ void BigNumber::_Divide(const BigNumber &other, BigNumber *remainder)
         }
         
         // Multiply and subtract
-        signed long long k = 0;
-        signed long long t = 0;
+        SignedDoubleDigitType k = 0;
+        SignedDoubleDigitType t = 0;
         for (UInt32 i = 0; i < n; i++) {
-            UInt64 p = qhat * vn[i];
+            DoubleDigitType p = qhat * vn[i];
             t = un[i + j] - k - (p & (b - 1));
-            un[i + j] = (UInt32)t;
+            un[i + j] = (DigitType)t;
             k = (p >> bs) - (t >> bs);
         }
         t = un[j + n] - k;
@@ -462,7 +802,7 @@ void BigNumber::_Divide(const BigNumber &other, BigNumber *remainder)
             q[j] -= 1;
             k = 0;
             for (UInt32 i = 0; i < n; i++) {
-                t = UInt64(un[i + j]) + UInt64(vn[i]) + k;
+                t = DoubleDigitType(un[i + j]) + DoubleDigitType(vn[i]) + k;
                 un[i + j] = (DigitType)t;
                 k = t >> bs;
             }
@@ -472,17 +812,14 @@ void BigNumber::_Divide(const BigNumber &other, BigNumber *remainder)
     
     if (r != NULL) {
         for (UInt32 i = 0; i < n - 1; i++)
-            r[i] = DigitType((un[i] >> s) | (UInt64(un[i + 1]) << (bs - s)));
+            r[i] = DigitType((un[i] >> s) | (DoubleDigitType(un[i + 1]) << (bs - s)));
         r[n - 1] = DigitType(un[n - 1] >> s);
-        remainder->Compact();
+        rest.Compact();
+        *remainder = std::move(rest);
     }
     
-    delete[] vn;
-    delete[] un;
-    delete[] _digits;
-    _digits = q;
-    _count = m - n + 1;
-    Compact();
+    quotient.Compact();
+    *this = std::move(quotient);
 }
 
 BigNumber BigNumber::PowerMod(const BigNumber &pow, const BigNumber &mod) const
@@ -490,34 +827,65 @@ BigNumber BigNumber::PowerMod(const BigNumber &pow, const BigNumber &mod) const
     if (!mod._positive || (mod == 0))
         throw std::runtime_error("Division by zero");
     assert(pow._positive);  // TODO: Negative division
+    if (mod == 1)
+        return 0;
     if (pow == 1)
         return *this % mod;
-    BigNumber s = 1;
-    BigNumber u = pow;
-    BigNumber t = *this;
-    while (u != 0) {
-        if ((u & 1) != 0)
-            (s * t)._Divide(mod, &s);
-        u >>= 1;
-        (t * t)._Divide(mod, &t);
-    }
-    return s;
+    // Odd moduli can use Montgomery multiplication, which avoids a division per step
+    if (mod._digits[0] & 1)
+        return Montgomery(mod).PowerMod(*this, pow);
+    // Even ones can still avoid the long division
+    return Barrett(mod).PowerMod(*this, pow);
+}
+
+UInt32 BigNumber::KaratsubaThreshold(void)
+{
+    return karatsubaThreshold;
+}
+
+void BigNumber::SetKaratsubaThreshold(UInt32 digits)
+{
+    // Any smaller and splitting wouldn't make the pieces smaller
+    if (digits < 4)
+        throw std::invalid_argument("Karatsuba threshold must be at least 4 digits");
+    karatsubaThreshold = digits;
 }
  
 BigNumber BigNumber::SquareRoot(void) const
 {
     if (*this < BigNumber(2))
         return *this;
-    BigNumber small = (*this >> 2).SquareRoot() << 1;
-    BigNumber large = small + 1;
-    return ((large * large) > *this) ? small : large;
+    // Newton's method, from a starting point above the root, so it descends until it can't go any lower
+    BigNumber x;
+    x.SetBit((BitLength() + 1) / 2);
+    while (true) {
+        BigNumber y = (x + (*this / x)) >> 1;
+        if (y >= x)
+            return x;
+        x = std::move(y);
+    }
 }
 
-int BigNumber::GetLowestSetBit(void)
+UInt32 BigNumber::Remainder(UInt32 divisor) const
+{
+    if (divisor == 0)
+        throw std::runtime_error("Division by zero");
+    // A 32 bit word at a time, so each step is a plain 64 bit division
+    UInt64 remainder = 0;
+    for (UInt32 i = _count; i-- > 0;) {
+        for (UInt32 j = WordsPerDigit; j-- > 0;)
+            remainder = ((remainder << 32) | UInt32(_digits[i] >> (j * 32))) % divisor;
+    }
+    return UInt32(remainder);
+}
+
+int BigNumber::GetLowestSetBit(void) const
 {
     for (int i = 0; i < _count; i++) {
+        if (_digits[i] == 0)
+            continue;
         for (int j = 0; j < (sizeof(DigitType) * 8); j++) {
-            if (_digits[i] & (1 << j)) {
+            if (_digits[i] & (DigitType(1) << j)) {
                 return (i * sizeof(DigitType) * 8) + j;
             }
         }
@@ -525,6 +893,20 @@ int BigNumber::GetLowestSetBit(void)
     return -1;
 }
 
+UInt64 BigNumber::Bits(UInt32 first) const
+{
+    const UInt32 digitBits = sizeof(DigitType) * 8;
+    UInt64 result = 0;
+    for (UInt32 got = 0; got < 64;) {
+        UInt32 index = (first + got) / digitBits, offset = (first + got) % digitBits;
+        if (index >= _count)
+            break;
+        result |= UInt64(_digits[index] >> offset) << got;
+        got += digitBits - offset;
+    }
+    return result;
+}
+
 int BigNumber::BitLength(void) const
 {
     // We should always have been compacted, so we can use that knowledge here
@@ -540,7 +922,7 @@ int BigNumber::BitLength(void) const
 
 int BigNumber::AsInt(void) const
 {
-    if (_count > 1)
+    if ((_count > 1) || (_digits[0] > DigitType(std::numeric_limits<int>::max())))
         throw std::runtime_error("BigNumber won't fit in an integer");
     if (_positive)
         return _digits[0];
@@ -548,12 +930,19 @@ int BigNumber::AsInt(void) const
         return -_digits[0];
 }
 
+UInt64 BigNumber::AsUInt64(void) const
+{
+    if (!_positive || (BitLength() > 64))
+        throw std::runtime_error("BigNumber won't fit in an unsigned 64 bit integer");
+    return Bits(0);
+}
+
 Types::Blob BigNumber::Data(void) const
 {
     Types::Blob result;
     if (_positive) {
         result.Append((Byte*)_digits, sizeof(DigitType) * _count);
-        if (_digits[_count - 1] & ((UInt64(1) << ((sizeof(DigitType) * 8) - 1)))) {
+        if (_digits[_count - 1] & (DigitType(1) << ((sizeof(DigitType) * 8) - 1))) {
             Byte zero = 0;
             result.Append(&zero, sizeof(zero));
         }
@@ -624,10 +1013,443 @@ std::string BigNumber::ToString(void) const
 
 BigNumber BigNumber::ModularInverse(const BigNumber& m)
 {
-    EuclideanGCD_Result result = EuclideanGCD(*this, m);
-    if (result.gcd != 1)
+    // Starting from (m, this mod m), so only the cofactor of this is needed
+    BigNumber u = m, v = *this % m, su = 0, sv = 1;
+    if (!v._positive)
+        v += m;
+    Lehmer(u, v, &su, &sv);
+    if (u != 1)
         throw std::runtime_error("Not reversible");
-    return (result.x % m + m) % m;
+    if (!su._positive)
+        su += m;
+    return su;
 }
-    
+
+#pragma mark -
+
+Montgomery::Montgomery(const BigNumber& modulus)
+:_modulus(modulus), _count(modulus._count)
+{
+    if (!modulus._positive || !(modulus._digits[0] & 1) || (modulus == 1))
+        throw std::invalid_argument("Montgomery modulus must be odd and greater than one");
+    // Newton's method doubles the number of correct low bits each step, starting from 3 as m * m = 1 (mod 8) for odd m
+    DigitType inverse = modulus._digits[0];
+    for (int i = 0; i < 5; i++)
+        inverse *= 2 - (modulus._digits[0] * inverse);
+    _inverse = DigitType(0) - inverse;
+    // R is the digit base to the power of the number of digits
+    BigNumber r;
+    r.SetBit(_count * sizeof(DigitType) * 8);
+    _one = r % modulus;
+    _rSquared = _one.Square() % modulus;
+}
+
+BigNumber Montgomery::PowerMod(const BigNumber& base, const BigNumber& exponent) const
+{
+    ScratchDigits<DigitType> buffer((_count * 2) + ScratchSize());
+    DigitType *x = buffer.Data();
+    DigitType *result = x + _count;
+    DigitType *scratch = result + _count;
+    // Convert the base into Montgomery form
+    BigNumber reduced = base % _modulus;
+    if (!reduced._positive && (reduced != 0))
+        reduced += _modulus;
+    Load(reduced, x);
+    Load(_rSquared, result);
+    Multiply(x, result, x, scratch);
+    // Table of odd powers, x^1, x^3, x^5...
+    int window = WindowSize(exponent.BitLength());
+    int tableSize = 1 << (window - 1);
+    ScratchDigits<DigitType> table(tableSize * _count);
+    memcpy(table.Data(), x, sizeof(DigitType) * _count);
+    if (tableSize > 1) {
+        Square(x, x, scratch);
+        for (int i = 1; i < tableSize; i++)
+            Multiply(table.Data() + ((i - 1) * _count), x, table.Data() + (i * _count), scratch);
+    }
+    Load(_one, result);
+    SlidingWindow(exponent, window,
+                  [&]{ Square(result, result, scratch); },
+                  [&](int index){ memcpy(result, table.Data() + (index * _count), sizeof(DigitType) * _count); },
+                  [&](int index){ Multiply(result, table.Data() + (index * _count), result, scratch); });
+    // Convert back, by multiplying by a plain one
+    memset(x, 0, sizeof(DigitType) * _count);
+    x[0] = 1;
+    Multiply(result, x, result, scratch);
+    return Store(result);
+}
+
+BigNumber Montgomery::PowerMod(const BigNumber& base, UInt32 exponent) const
+{
+    if (exponent == 0)
+        return 1;
+    ScratchDigits<DigitType> buffer((_count * 2) + ScratchSize());
+    DigitType *x = buffer.Data();
+    DigitType *result = x + _count;
+    DigitType *scratch = result + _count;
+    // Convert the base into Montgomery form
+    BigNumber reduced = base % _modulus;
+    if (!reduced._positive && (reduced != 0))
+        reduced += _modulus;
+    Load(reduced, x);
+    Load(_rSquared, result);
+    Multiply(x, result, x, scratch);
+    // Left to right from below the top bit, which is the copy of x the result starts as
+    memcpy(result, x, sizeof(DigitType) * _count);
+    int bit = 31;
+    while (!(exponent & (UInt32(1) << bit)))
+        bit--;
+    while (bit--) {
+        Square(result, result, scratch);
+        if (exponent & (UInt32(1) << bit))
+            Multiply(result, x, result, scratch);
+    }
+    // Convert back, by multiplying by a plain one
+    memset(x, 0, sizeof(DigitType) * _count);
+    x[0] = 1;
+    Multiply(result, x, result, scratch);
+    return Store(result);
+}
+
+void Montgomery::Load(const BigNumber& value, DigitType *output) const
+{
+    // Value must already be reduced, so it has no more digits than the modulus
+    memcpy(output, value._digits, sizeof(DigitType) * value._count);
+    memset(output + value._count, 0, sizeof(DigitType) * (_count - value._count));
+}
+
+BigNumber Montgomery::Store(const DigitType *input) const
+{
+    BigNumber result;
+    result.Expand(_count);
+    memcpy(result._digits, input, sizeof(DigitType) * _count);
+    result.Compact();
+    return result;
+}
+
+void Montgomery::Multiply(const DigitType *a, const DigitType *b, DigitType *result, DigitType *t) const
+{
+    // Coarsely integrated operand scanning: for each digit of b, add a * b[i] and then a multiple of the modulus that
+    // makes the lowest digit zero, and shift it out.
+    const UInt32 n = _count;
+    const int bits = sizeof(DigitType) * 8;
+    memset(t, 0, sizeof(DigitType) * (n + 2));
+    for (UInt32 i = 0; i < n; i++) {
+        DoubleDigitType carry = 0;
+        for (UInt32 j = 0; j < n; j++) {
+            DoubleDigitType sum = DoubleDigitType(t[j]) + (DoubleDigitType(a[j]) * b[i]) + carry;
+            t[j] = DigitType(sum);
+            carry = sum >> bits;
+        }
+        DoubleDigitType sum = DoubleDigitType(t[n]) + carry;
+        t[n] = DigitType(sum);
+        t[n + 1] = DigitType(sum >> bits);
+        
+        DigitType m = t[0] * _inverse;
+        carry = (DoubleDigitType(t[0]) + (DoubleDigitType(m) * _modulus._digits[0])) >> bits;
+        for (UInt32 j = 1; j < n; j++) {
+            sum = DoubleDigitType(t[j]) + (DoubleDigitType(m) * _modulus._digits[j]) + carry;
+            t[j - 1] = DigitType(sum);
+            carry = sum >> bits;
+        }
+        sum = DoubleDigitType(t[n]) + carry;
+        t[n - 1] = DigitType(sum);
+        t[n] = t[n + 1] + DigitType(sum >> bits);
+    }
+    Finish(t, result);
+}
+
+void Montgomery::Square(const DigitType *a, DigitType *result, DigitType *scratch) const
+{
+    // Square in full, then reduce (separated operand scanning), as squaring is cheaper than a general multiply
+    const UInt32 n = _count;
+    const int bits = sizeof(DigitType) * 8;
+    DigitType *t = scratch;
+    if (n < karatsubaThreshold)
+        SchoolbookSquare(a, n, t);
+    else
+        KaratsubaSquare(a, n, t, t + (2 * n) + 1);
+    t[2 * n] = 0;
+    for (UInt32 i = 0; i < n; i++) {
+        DigitType m = t[i] * _inverse;
+        DoubleDigitType carry = 0;
+        for (UInt32 j = 0; j < n; j++) {
+            DoubleDigitType sum = DoubleDigitType(t[i + j]) + (DoubleDigitType(m) * _modulus._digits[j]) + carry;
+            t[i + j] = DigitType(sum);
+            carry = sum >> bits;
+        }
+        for (UInt32 k = i + n; carry && (k <= (2 * n)); k++) {
+            DoubleDigitType sum = DoubleDigitType(t[k]) + carry;
+            t[k] = DigitType(sum);
+            carry = sum >> bits;
+        }
+    }
+    Finish(t + n, result);
+}
+
+UInt32 Montgomery::ScratchSize(void) const
+{
+    // Room for a double length product with a spare digit, plus whatever Karatsuba squaring needs
+    return (2 * _count) + 1 + KaratsubaScratch(_count);
+}
+
+void Montgomery::Finish(const DigitType *t, DigitType *result) const
+{
+    // t has one more digit than the modulus, and is less than twice it, so at most one subtraction brings it into range
+    const UInt32 n = _count;
+    const int bits = sizeof(DigitType) * 8;
+    bool subtract = t[n] != 0;
+    if (!subtract) {
+        subtract = true;
+        for (UInt32 i = n; i-- > 0;) {
+            if (t[i] != _modulus._digits[i]) {
+                subtract = t[i] > _modulus._digits[i];
+                break;
+            }
+        }
+    }
+    if (subtract) {
+        DoubleDigitType borrow = 0;
+        for (UInt32 i = 0; i < n; i++) {
+            DoubleDigitType difference = DoubleDigitType(t[i]) - _modulus._digits[i] - borrow;
+            result[i] = DigitType(difference);
+            borrow = (difference >> bits) & 1;
+        }
+    } else {
+        memcpy(result, t, sizeof(DigitType) * n);
+    }
+}
+
+#pragma mark -
+
+Barrett::Barrett(const BigNumber& modulus)
+:_modulus(modulus), _count(modulus._count)
+{
+    if (!modulus._positive || (modulus == 0))
+        throw std::invalid_argument("Barrett modulus must be positive");
+    _mu.SetBit(2 * _count * sizeof(DigitType) * 8);
+    _mu /= modulus;
+}
+
+void Barrett::Reduce(const BigNumber& value, BigNumber& result) const
+{
+    if (!value._positive || (value._count > (2 * _count))) {
+        result = value % _modulus;
+        return;
+    }
+    ScratchDigits<DigitType> buffer(_count + ScratchSize());
+    Reduce(value._digits, value._count, buffer.Data(), buffer.Data() + _count);
+    Store(buffer.Data(), result);
+}
+
+void Barrett::MulMod(const BigNumber& a, const BigNumber& b, BigNumber& result) const
+{
+    Reduce(a * b, result);
+}
+
+void Barrett::SquareMod(const BigNumber& a, BigNumber& result) const
+{
+    Reduce(a.Square(), result);
+}
+
+BigNumber Barrett::PowerMod(const BigNumber& base, const BigNumber& exponent) const
+{
+    assert(exponent._positive);
+    const UInt32 k = _count;
+    BigNumber reduced;
+    Reduce(base, reduced);
+    if (!reduced._positive && (reduced != 0))
+        reduced += _modulus;
+    if (exponent == 0)
+        return Reduce(1);
+    // Work on fixed length digits, with room for a double length product and the reduction's scratch
+    ScratchDigits<DigitType> buffer((2 * k) + 1 + KaratsubaScratch(k) + k + ScratchSize());
+    DigitType *product = buffer.Data();
+    DigitType *result = product + (2 * k) + 1 + KaratsubaScratch(k);
+    DigitType *scratch = result + k;
+    auto multiply = [&](const DigitType *a, const DigitType *b, DigitType *output) {
+        LongMultiply(a, k, b, k, product);
+        Reduce(product, 2 * k, output, scratch);
+    };
+    auto square = [&](const DigitType *a, DigitType *output) {
+        if (k < karatsubaThreshold)
+            SchoolbookSquare(a, k, product);
+        else
+            KaratsubaSquare(a, k, product, product + (2 * k) + 1);
+        Reduce(product, 2 * k, output, scratch);
+    };
+    // Table of odd powers
+    int window = WindowSize(exponent.BitLength());
+    int tableSize = 1 << (window - 1);
+    ScratchDigits<DigitType> table(tableSize * k);
+    memcpy(table.Data(), reduced._digits, sizeof(DigitType) * reduced._count);
+    memset(table.Data() + reduced._count, 0, sizeof(DigitType) * (k - reduced._count));
+    if (tableSize > 1) {
+        square(table.Data(), result);
+        for (int i = 1; i < tableSize; i++)
+            multiply(table.Data() + ((i - 1) * k), result, table.Data() + (i * k));
+    }
+    SlidingWindow(exponent, window,
+                  [&]{ square(result, result); },
+                  [&](int index){ memcpy(result, table.Data() + (index * k), sizeof(DigitType) * k); },
+                  [&](int index){ multiply(result, table.Data() + (index * k), result); });
+    BigNumber s;
+    Store(result, s);
+    return s;
+}
+
+UInt32 Barrett::ScratchSize(void) const
+{
+    // The quotient estimate's product, and the k + 1 digit remainder
+    return (3 * _count) + 4;
+}
+
+void Barrett::Reduce(const DigitType *x, UInt32 n, DigitType *result, DigitType *scratch) const
+{
+    // HAC 14.42, for x of at most 2k digits. The quotient is estimated from the top digits, which leaves it at most
+    // three too small given the skipped low columns below, and that multiple of the modulus is taken off modulo b^(k+1),
+    // as the remainder is known to fit.
+    const UInt32 k = _count;
+    const int bits = sizeof(DigitType) * 8;
+    const DigitType *m = _modulus._digits;
+    if (n < k) {
+        memcpy(result, x, sizeof(DigitType) * n);
+        memset(result + n, 0, sizeof(DigitType) * (k - n));
+        return;
+    }
+    // q = (x / b^(k-1)) * mu / b^(k+1), skipping columns that can't reach the digits kept
+    const DigitType *q1 = x + (k - 1);
+    const UInt32 n1 = n - (k - 1);
+    const DigitType *mu = _mu._digits;
+    const UInt32 nm = _mu._count;
+    DigitType *t = scratch;
+    memset(t, 0, sizeof(DigitType) * (n1 + nm));
+    for (UInt32 i = 0; i < n1; i++) {
+        DoubleDigitType carry = 0;
+        for (UInt32 j = (i < (k - 1)) ? (k - 1 - i) : 0; j < nm; j++) {
+            DoubleDigitType sum = DoubleDigitType(t[i + j]) + (DoubleDigitType(q1[i]) * mu[j]) + carry;
+            t[i + j] = DigitType(sum);
+            carry = sum >> bits;
+        }
+        t[i + nm] = DigitType(carry);
+    }
+    const DigitType *q = t + k + 1;
+    const UInt32 nq = std::min(n1 + nm - (k + 1), k + 1);
+    // r = x - q * m, in the low k + 1 digits only
+    DigitType *r = t + n1 + nm;
+    memset(r, 0, sizeof(DigitType) * (k + 1));
+    for (UInt32 i = 0; i < nq; i++) {
+        DoubleDigitType carry = 0;
+        UInt32 end = std::min(k, (k + 1) - i);
+        for (UInt32 j = 0; j < end; j++) {
+            DoubleDigitType sum = DoubleDigitType(r[i + j]) + (DoubleDigitType(q[i]) * m[j]) + carry;
+            r[i + j] = DigitType(sum);
+            carry = sum >> bits;
+        }
+        if ((i + end) <= k)
+            r[i + end] += DigitType(carry);
+    }
+    DoubleDigitType borrow = 0;
+    for (UInt32 i = 0; i <= k; i++) {
+        DoubleDigitType difference = DoubleDigitType((i < n) ? x[i] : 0) - r[i] - borrow;
+        r[i] = DigitType(difference);
+        borrow = (difference >> bits) & 1;
+    }
+    // Then the few subtractions left
+    while (true) {
+        bool subtract = r[k] != 0;
+        if (!subtract) {
+            subtract = true;
+            for (UInt32 i = k; i-- > 0;) {
+                if (r[i] != m[i]) {
+                    subtract = r[i] > m[i];
+                    break;
+                }
+            }
+        }
+        if (!subtract)
+            break;
+        borrow = 0;
+        for (UInt32 i = 0; i <= k; i++) {
+            DoubleDigitType difference = DoubleDigitType(r[i]) - ((i < k) ? m[i] : 0) - borrow;
+            r[i] = DigitType(difference);
+            borrow = (difference >> bits) & 1;
+        }
+    }
+    memcpy(result, r, sizeof(DigitType) * k);
+}
+
+void Barrett::Store(const DigitType *input, BigNumber& output) const
+{
+    output.Expand(_count);
+    memcpy(output._digits, input, sizeof(DigitType) * _count);
+    output._count = _count;
+    output._positive = true;
+    output.Compact();
+}
+
+#pragma mark -
+
+FixedBase::FixedBase(const Montgomery& field, const BigNumber& base, int exponentBits)
+:_field(field), _base(base), _teeth((exponentBits >= 1024) ? 8 : 6)
+{
+    const UInt32 k = _field._count;
+    _spacing = std::max((exponentBits + _teeth - 1) / _teeth, 1);
+    _table.resize((size_t(1) << _teeth) * k);
+    ScratchDigits<DigitType> buffer((2 * k) + _field.ScratchSize());
+    DigitType *power = buffer.Data();
+    DigitType *x = power + k;
+    DigitType *scratch = x + k;
+    // Entry 2^j is base^(2^(j * spacing)), and the others are products of those for each set bit in the index
+    BigNumber reduced = base % _field._modulus;
+    if (!reduced._positive && (reduced != 0))
+        reduced += _field._modulus;
+    _field.Load(reduced, power);
+    _field.Load(_field._rSquared, x);
+    _field.Multiply(power, x, power, scratch);
+    _field.Load(_field._one, _table.data());
+    for (int j = 0; j < _teeth; j++) {
+        if (j != 0) {
+            for (int i = 0; i < _spacing; i++)
+                _field.Square(power, power, scratch);
+        }
+        size_t bit = size_t(1) << j;
+        memcpy(_table.data() + (bit * k), power, sizeof(DigitType) * k);
+        for (size_t i = 1; i < bit; i++)
+            _field.Multiply(_table.data() + (i * k), power, _table.data() + ((bit + i) * k), scratch);
+    }
+}
+
+BigNumber FixedBase::PowerMod(const BigNumber& exponent) const
+{
+    assert(exponent._positive);
+    if (exponent.BitLength() > (_teeth * _spacing))
+        return _field.PowerMod(_base, exponent);
+    const UInt32 k = _field._count;
+    ScratchDigits<DigitType> buffer((2 * k) + _field.ScratchSize());
+    DigitType *result = buffer.Data();
+    DigitType *x = result + k;
+    DigitType *scratch = x + k;
+    _field.Load(_field._one, result);
+    bool started = false;
+    for (int column = _spacing - 1; column >= 0; column--) {
+        if (started)
+            _field.Square(result, result, scratch);
+        size_t index = 0;
+        for (int j = 0; j < _teeth; j++) {
+            if (exponent.TestBit((j * _spacing) + column))
+                index |= size_t(1) << j;
+        }
+        if (index != 0) {
+            _field.Multiply(result, _table.data() + (index * k), result, scratch);
+            started = true;
+        }
+    }
+    // Convert back, by multiplying by a plain one
+    memset(x, 0, sizeof(DigitType) * k);
+    x[0] = 1;
+    _field.Multiply(result, x, result, scratch);
+    return _field.Store(result);
+}
+
 } // namespace minissh::Maths
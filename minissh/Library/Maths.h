@@ -10,14 +10,41 @@
 
 #include <cstdio>
 #include <memory>
+#include <vector>
 #include "BaseTypes.h"
 
+// Size of a BigNumber digit, in bits. 64 bit digits need a 128 bit type to hold the product of two, which GCC and Clang
+// provide on 64 bit targets, and take a quarter of the multiplications. Elsewhere (e.g. microcontrollers) digits are
+// 32 bits. Define this to 32 or 64 to override.
+#ifndef BIGNUMBER_DIGIT_BITS
+#if defined(__SIZEOF_INT128__) && (defined(__x86_64__) || defined(__aarch64__))
+#define BIGNUMBER_DIGIT_BITS 64
+#else
+#define BIGNUMBER_DIGIT_BITS 32
+#endif
+#endif
+
+// Room kept inside every BigNumber, in bits, so that values up to this size never touch the heap. Larger values still
+// work, using heap storage. Targets with 32 bit digits are likely to be short of stack, so keep less by default, enough
+// for 2048 bit keys and groups. Memory constrained targets can define this smaller.
+#ifndef BIGNUMBER_INLINE_BITS
+#if BIGNUMBER_DIGIT_BITS == 64
+#define BIGNUMBER_INLINE_BITS 8192
+#else
+#define BIGNUMBER_INLINE_BITS 2048
+#endif
+#endif
+
 namespace minissh::Types {
 class Blob;
 }
 
 namespace minissh::Maths {
 
+class Montgomery;
+class Barrett;
+class FixedBase;
+
 /**
  * Interface for providing random numbers.
  */
@@ -35,26 +62,47 @@ public:
 class BigNumber
 {
 private:
+    friend Montgomery;
+    friend Barrett;
+    friend FixedBase;
+    
+#if BIGNUMBER_DIGIT_BITS == 64
+    typedef UInt64 DigitType;
+    typedef unsigned __int128 DoubleDigitType;
+    typedef __int128 SignedDoubleDigitType;
+#else
     typedef UInt32 DigitType;
+    typedef UInt64 DoubleDigitType;
+    typedef long long SignedDoubleDigitType;
+#endif
+    static constexpr UInt32 InlineDigits = BIGNUMBER_INLINE_BITS / BIGNUMBER_DIGIT_BITS;
+    static_assert(InlineDigits > 0, "BigNumber needs room for at least one digit");
+    
     bool _positive;
-    DigitType *_digits;
-    UInt32 _count;
+    DigitType *_digits;     // Points at _inline, unless more digits have been needed than fit there
+    UInt32 _count;          // Digits in use
+    UInt32 _capacity;       // Digits available in _digits
+    DigitType _inline[InlineDigits];
     
     void Add(const BigNumber &other);
     void Subtract(const BigNumber &other);
     void Multiply(const BigNumber &other);
     void _Divide(const BigNumber &other, BigNumber *remainder);
     int Compare(const BigNumber &other) const;
+    void Reserve(UInt32 size);  // Makes room for at least size digits, keeping the current value
     void Expand(UInt32 size);
     void Compact(void);
     void CheckSign(void);
+    UInt64 Bits(UInt32 first) const;    // The 64 bits starting at the given bit
+    static void Lehmer(BigNumber &u, BigNumber &v, BigNumber *su, BigNumber *sv);
     
 public:
     BigNumber();
     BigNumber(int simpleValue);
     BigNumber(const BigNumber &original);
+    BigNumber(BigNumber &&original);
     BigNumber(const void *bytes, UInt32 count, bool checkSign = true);
-    BigNumber(const UInt32 *data, UInt32 count, bool reverse = false);
+    BigNumber(const UInt32 *data, UInt32 count, bool reverse = false);    // Least significant word first, unless reversed
     BigNumber(UInt32 bits, IRandomSource &source);
     ~BigNumber();
     
@@ -70,42 +118,63 @@ public:
         return result;
     }
     BigNumber PowerMod(const BigNumber &pow, const BigNumber &mod) const;
+    BigNumber Square(void) const;   // Quicker than multiplying by itself
+    // Operands of this many digits or more are multiplied and squared with Karatsuba rather than the schoolbook method.
+    // Adjustable for tuning, but not while other threads might be doing arithmetic.
+    static UInt32 KaratsubaThreshold(void);
+    static void SetKaratsubaThreshold(UInt32 digits);   // At least 4
+    // Modular arithmetic into a destination, which may also be one of the operands. These avoid the temporaries of
+    // the equivalent operators, and the results are remainders in the same way as %.
+    static void MulMod(const BigNumber &a, const BigNumber &b, const BigNumber &mod, BigNumber &result);
+    static void SquareMod(const BigNumber &a, const BigNumber &mod, BigNumber &result);
+    static void AddMod(const BigNumber &a, const BigNumber &b, const BigNumber &mod, BigNumber &result);  // Operands must be non-negative
     BigNumber ModularInverse(const BigNumber &m);
     BigNumber GCD(const BigNumber& b) const;
     BigNumber GCD(const BigNumber& b, BigNumber& x, BigNumber& y) const;
     BigNumber SquareRoot(void) const;
+    UInt32 Remainder(UInt32 divisor) const;     // Of the magnitude, quicker than % for a small divisor
 
-    int GetLowestSetBit(void);
+    int GetLowestSetBit(void) const;
     int BitLength(void) const;
+    bool TestBit(UInt32 bit) const;
+    void SetBit(UInt32 bit);
     int AsInt(void) const;
+    UInt64 AsUInt64(void) const;
     
     // A big pile of operators
     
-    bool operator[](UInt32 index) const;
+    bool operator[](UInt32 index) const
+    {
+        return TestBit(index);
+    }
     BigNumber& operator=(const BigNumber &other)    // Copy assignment
     {
         if (this != &other) {
-            if (_count != other._count) {
-                delete[] _digits;
-                _count = other._count;
-                _digits = new DigitType[_count];
+            if (_capacity < other._count) {
+                _count = 1; // Nothing worth keeping
+                Reserve(other._count);
             }
-            memcpy(_digits, other._digits, sizeof(DigitType) * _count);
+            memcpy(_digits, other._digits, sizeof(DigitType) * other._count);
+            _count = other._count;
             _positive = other._positive;
         }
         return *this;
     }
     BigNumber& operator=(BigNumber &&other) // Move assignment
     {
-        DigitType *tempDigits = other._digits;
-        bool tempPositive = other._positive;
-        UInt32 tempCount = other._count;
-        other._digits = _digits;
-        other._positive = _positive;
-        other._count = _count;
-        _digits = tempDigits;
-        _positive = tempPositive;
-        _count = tempCount;
+        if ((this == &other) || (other._digits == other._inline))
+            return operator=(static_cast<const BigNumber&>(other)); // Inline digits can't be taken, only copied
+        if (_digits != _inline)
+            delete[] _digits;
+        _digits = other._digits;
+        _capacity = other._capacity;
+        _count = other._count;
+        _positive = other._positive;
+        other._digits = other._inline;
+        other._capacity = InlineDigits;
+        other._count = 1;
+        other._digits[0] = 0;
+        other._positive = true;
         return *this;
     }
     BigNumber& operator++()
@@ -158,6 +227,7 @@ public:
             } else {
                 BigNumber temp(*this); // Make a note of our old value
                 *this = rightSide;  // Copy right hand side
+                _positive = true;   // -a - -b is |b| - |a|
                 Subtract(temp);
             }
         } else {
@@ -222,13 +292,31 @@ public:
         leftSide ^= rightSide;
         return leftSide;
     }
-    BigNumber& operator>>=(const BigNumber &rightSide);
+    BigNumber& operator>>=(int amount);
+    friend BigNumber operator>>(BigNumber leftSide, int amount)
+    {
+        leftSide >>= amount;
+        return leftSide;
+    }
+    BigNumber& operator>>=(const BigNumber &rightSide)
+    {
+        return operator>>=(rightSide.AsInt());
+    }
     friend BigNumber operator>>(BigNumber leftSide, const BigNumber &rightSide)
     {
         leftSide >>= rightSide;
         return leftSide;
     }
-    BigNumber& operator<<=(const BigNumber &rightSide);
+    BigNumber& operator<<=(int amount);
+    friend BigNumber operator<<(BigNumber leftSide, int amount)
+    {
+        leftSide <<= amount;
+        return leftSide;
+    }
+    BigNumber& operator<<=(const BigNumber &rightSide)
+    {
+        return operator<<=(rightSide.AsInt());
+    }
     friend BigNumber operator<<(BigNumber leftSide, const BigNumber &rightSide)
     {
         leftSide <<= rightSide;
@@ -261,4 +349,103 @@ public:
     }
 };
 
+/**
+ * Precomputed state for Montgomery multiplication modulo a fixed odd number. Build one for a modulus and reuse it:
+ * values are kept in Montgomery form while working, so each modular multiplication is a single fused multiply and
+ * reduce into preallocated buffers, with no division. Contexts aren't modified once built, so can be shared.
+ */
+class Montgomery
+{
+public:
+    Montgomery(const BigNumber& modulus);   // The modulus must be odd, and greater than one
+    
+    const BigNumber& Modulus(void) const { return _modulus; }
+    
+    BigNumber PowerMod(const BigNumber& base, const BigNumber& exponent) const;
+    // Plain square and multiply, for short exponents like the usual RSA public exponent of 65537, where building a
+    // window table would cost more than it saves
+    BigNumber PowerMod(const BigNumber& base, UInt32 exponent) const;
+    
+private:
+    friend FixedBase;
+    
+    typedef BigNumber::DigitType DigitType;
+    typedef BigNumber::DoubleDigitType DoubleDigitType;
+    
+    BigNumber _modulus;
+    UInt32 _count;                  // Digits in the modulus, and in every value in Montgomery form
+    DigitType _inverse;             // -modulus^-1 mod the digit base
+    BigNumber _rSquared;            // R^2 mod modulus, for converting into Montgomery form
+    BigNumber _one;                 // R mod modulus, which is one in Montgomery form
+    
+    void Load(const BigNumber& value, DigitType *output) const;
+    BigNumber Store(const DigitType *input) const;
+    UInt32 ScratchSize(void) const;
+    void Multiply(const DigitType *a, const DigitType *b, DigitType *result, DigitType *scratch) const;
+    void Square(const DigitType *a, DigitType *result, DigitType *scratch) const;
+    void Finish(const DigitType *t, DigitType *result) const;
+};
+
+/**
+ * Precomputed reciprocal of a fixed modulus, for reducing by it with multiplications and shifts instead of long
+ * division (Barrett reduction). This suits even moduli, which Montgomery multiplication can't handle, and one-off
+ * reductions where converting in and out of Montgomery form would cost more than it saves. Contexts aren't modified
+ * once built, so can be shared.
+ */
+class Barrett
+{
+public:
+    Barrett(const BigNumber& modulus);  // The modulus must be positive
+    
+    const BigNumber& Modulus(void) const { return _modulus; }
+    
+    // Results are remainders in the same way as %. Values that are negative, or have more than twice the digits of
+    // the modulus, fall back to division.
+    void Reduce(const BigNumber& value, BigNumber& result) const;   // The result may be the value
+    BigNumber Reduce(const BigNumber& value) const
+    {
+        BigNumber result;
+        Reduce(value, result);
+        return result;
+    }
+    void MulMod(const BigNumber& a, const BigNumber& b, BigNumber& result) const;
+    void SquareMod(const BigNumber& a, BigNumber& result) const;
+    BigNumber PowerMod(const BigNumber& base, const BigNumber& exponent) const;
+    
+private:
+    typedef BigNumber::DigitType DigitType;
+    typedef BigNumber::DoubleDigitType DoubleDigitType;
+    
+    BigNumber _modulus;
+    UInt32 _count;      // Digits in the modulus, k
+    BigNumber _mu;      // floor(b^2k / modulus), for the digit base b
+    
+    UInt32 ScratchSize(void) const;
+    void Reduce(const DigitType *x, UInt32 count, DigitType *result, DigitType *scratch) const;  // At most 2k digits in
+    void Store(const DigitType *input, BigNumber& output) const;
+};
+
+/**
+ * Powers of a fixed base modulo a fixed odd number, from a precomputed comb table (Lim-Lee). The exponent is split into
+ * rows, and the bits in each column index a table of products of the rows' starting powers, so a power costs one squaring
+ * and at most one multiplication per column rather than per bit. Worth building when one base is raised to many
+ * exponents, such as a Diffie-Hellman generator. Contexts aren't modified once built, so can be shared.
+ */
+class FixedBase
+{
+public:
+    FixedBase(const Montgomery& field, const BigNumber& base, int exponentBits);   // Longer exponents are still handled
+    
+    BigNumber PowerMod(const BigNumber& exponent) const;
+    
+private:
+    typedef BigNumber::DigitType DigitType;
+    
+    Montgomery _field;
+    BigNumber _base;
+    int _teeth;                     // Rows the exponent is split into, so the table has 2^teeth entries
+    int _spacing;                   // Bits in each row
+    std::vector<DigitType> _table;  // Each entry in Montgomery form
+};
+
 } // namespace minissh::Maths
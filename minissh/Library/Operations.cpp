@@ -6,6 +6,8 @@
 //  Copyright (c) 2016-2020 MICE Software. All rights reserved.
 //
 
+#include <memory.h>
+#include <algorithm>
 #include "Operations.h"
 
 // As per http://csrc.nist.gov/publications/nistpubs/800-38a/sp800-38a.pdf
@@ -13,25 +15,47 @@
 
 namespace minissh::Algorithm {
 
+namespace {
+
+constexpr size_t KeystreamSize = 256;   // How much CTR keystream to generate per call to the cypher, at least a block
+
+void Xor(Byte *output, const Byte *input, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        output[i] ^= input[i];
+}
+
+} // namespace
+
 OperationCBC::OperationCBC(AEncryption& encryption, Types::Blob initialisationVector)
 :AOperation(encryption, initialisationVector)
 {
 }
 
-Types::Blob OperationCBC::Encrypt(Types::Blob data)
+void OperationCBC::EncryptInPlace(Byte *data, size_t length)
 {
-    Types::Blob combined = data.XorWith(_currentVector);
-    Types::Blob result = _encryption.Encrypt(combined);
-    SetVector(result);
-    return result;
+    size_t blockSize = CheckLength(length);
+    Byte *vector = _currentVector.MutableValue();
+    for (size_t offset = 0; offset < length; offset += blockSize) {
+        Byte *block = data + offset;
+        Xor(block, vector, blockSize);
+        _encryption.EncryptInPlace(block, blockSize);
+        memcpy(vector, block, blockSize);
+    }
 }
 
-Types::Blob OperationCBC::Decrypt(Types::Blob data)
+void OperationCBC::DecryptInPlace(Byte *data, size_t length)
 {
-    Types::Blob decrypted = _encryption.Decrypt(data);
-    Types::Blob result = decrypted.XorWith(_currentVector);
-    SetVector(data);
-    return result;
+    size_t blockSize = CheckLength(length);
+    Byte *vector = _currentVector.MutableValue();
+    Byte cypherText[MaximumBlockSize];
+    for (size_t offset = 0; offset < length; offset += blockSize) {
+        Byte *block = data + offset;
+        memcpy(cypherText, block, blockSize);
+        _encryption.DecryptInPlace(block, blockSize);
+        Xor(block, vector, blockSize);
+        memcpy(vector, cypherText, blockSize);
+    }
 }
 
 OperationCTR::OperationCTR(AEncryption& encryption, Types::Blob initialisationVector)
@@ -39,24 +63,34 @@ OperationCTR::OperationCTR(AEncryption& encryption, Types::Blob initialisationVe
 {
 }
 
-Types::Blob OperationCTR::Encrypt(Types::Blob data)
+void OperationCTR::EncryptInPlace(Byte *data, size_t length)
 {
-    Types::Blob encrypted = _encryption.Encrypt(_currentVector);
-    Types::Blob result = encrypted.XorWith(data);
-    Step();
-    return result;
+    size_t blockSize = CheckLength(length);
+    size_t batch = KeystreamSize - (KeystreamSize % blockSize);
+    Byte keystream[KeystreamSize];
+    while (length) {
+        // Lay out a run of counter values and encrypt them all in one go
+        size_t amount = std::min(length, batch);
+        for (size_t offset = 0; offset < amount; offset += blockSize) {
+            memcpy(keystream + offset, _currentVector.Value(), blockSize);
+            Step();
+        }
+        _encryption.EncryptInPlace(keystream, amount);
+        Xor(data, keystream, amount);
+        data += amount;
+        length -= amount;
+    }
 }
 
-Types::Blob OperationCTR::Decrypt(Types::Blob data)
+void OperationCTR::DecryptInPlace(Byte *data, size_t length)
 {
-    return Encrypt(data);
+    EncryptInPlace(data, length);
 }
 
 void OperationCTR::Step(void)
 {
-    // HACK: modify the blob
     int j = _currentVector.Length();
-    Byte *values = (Byte*)_currentVector.Value();
+    Byte *values = _currentVector.MutableValue();
     while (--j >= 0 && ++values[j] == 0);
 }
 
@@ -17,8 +17,8 @@ class OperationCBC : public AOperation
 public:
     OperationCBC(AEncryption& encryption, Types::Blob initialisationVector);
     
-    Types::Blob Encrypt(Types::Blob data);
-    Types::Blob Decrypt(Types::Blob data);
+    void EncryptInPlace(Byte *data, size_t length) override;
+    void DecryptInPlace(Byte *data, size_t length) override;
 };
 
 class OperationCTR : public AOperation
@@ -26,8 +26,8 @@ class OperationCTR : public AOperation
 public:
     OperationCTR(AEncryption& encryption, Types::Blob initialisationVector);
     
-    Types::Blob Encrypt(Types::Blob data);
-    Types::Blob Decrypt(Types::Blob data);
+    void EncryptInPlace(Byte *data, size_t length) override;
+    void DecryptInPlace(Byte *data, size_t length) override;
     
 private:
     void Step(void);
@@ -6,7 +6,14 @@
 //  Copyright © 2020 MICE Software. All rights reserved.
 //
 
+#include <limits>
+#include <atomic>
+#include <functional>
 #include "Primes.h"
+#if MINISSH_THREADS
+#include <thread>
+#include <mutex>
+#endif
 
 namespace minissh::Maths::Primes {
 
@@ -46,12 +53,305 @@ template<> Maths::BigNumber ceiling_divide(Maths::BigNumber x, Maths::BigNumber
 const Maths::BigNumber ONE(1);
 const Maths::BigNumber TWO(2);
 
+// Odd primes below this are kept in a table, worked out at compile time
+constexpr UInt32 SmallPrimeLimit = 1 << 14;
+
+struct SmallSieve
+{
+    bool composite[SmallPrimeLimit] = {};
+    
+    constexpr SmallSieve()
+    {
+        for (UInt32 i = 3; (i * i) < SmallPrimeLimit; i += 2)
+            if (!composite[i])
+                for (UInt32 j = i * i; j < SmallPrimeLimit; j += 2 * i)
+                    composite[j] = true;
+    }
+};
+
+constexpr UInt32 CountSmallPrimes(void)
+{
+    SmallSieve sieve;
+    UInt32 count = 0;
+    for (UInt32 i = 3; i < SmallPrimeLimit; i += 2)
+        if (!sieve.composite[i])
+            count++;
+    return count;
+}
+
+template<UInt32 Count> struct PrimeTable
+{
+    UInt32 values[Count] = {};
+    
+    constexpr PrimeTable()
+    {
+        SmallSieve sieve;
+        UInt32 count = 0;
+        for (UInt32 i = 3; i < SmallPrimeLimit; i += 2)
+            if (!sieve.composite[i])
+                values[count++] = i;
+    }
+    constexpr UInt32 size(void) const { return Count; }
+    constexpr const UInt32* begin(void) const { return values; }
+    constexpr const UInt32* end(void) const { return values + Count; }
+};
+
+constexpr PrimeTable<CountSmallPrimes()> SmallPrimes;
+
+// The numbers below 210 with no factor of 2, 3, 5 or 7, which is all a prime above those can be modulo 210
+constexpr UInt32 WheelSize = 2 * 3 * 5 * 7;
+
+struct Wheel
+{
+    UInt32 spokes[48] = {};
+    
+    constexpr Wheel()
+    {
+        UInt32 count = 0;
+        for (UInt32 i = 1; i < WheelSize; i++)
+            if ((i % 2) && (i % 3) && (i % 5) && (i % 7))
+                spokes[count++] = i;
+    }
+};
+
+constexpr Wheel WheelSpokes;
+
+// FIPS 186.4 table C.3, for a 2^-100 or lower chance of a composite passing (more than the table asks for at 1024 and
+// 1536 bits, rounding to the safe side). Shorter lengths use the worst case from table C.1.
+int MillerRabinIterations(int length)
+{
+    if (length >= 1536)
+        return 4;
+    if (length >= 1024)
+        return 5;
+    if (length >= 512)
+        return 7;
+    return 40;
+}
+
+// Random number of exactly length bits, with the low bit set
+Maths::BigNumber RandomOdd(IRandomSource& random, int length)
+{
+    Maths::BigNumber result(UInt32(length), random);
+    result %= ONE << (length - 1);
+    result.SetBit(length - 1);
+    result.SetBit(0);
+    return result;
+}
+
+// Bits drawn from the caller's source to seed each search
+constexpr UInt32 SeedBits = 256;
+
+/**
+ * Numbers from hashing a seed, an index and a counter. Each part of a search gets its own stream, so what it finds
+ * doesn't depend on which thread ran it, or when.
+ */
+class HashStream : public IRandomSource
+{
+public:
+    HashStream(const Types::Blob& seed, UInt64 index)
+    :_seed(seed), _index(index), _counter(0), _offset(0)
+    {
+    }
+    
+    UInt32 Random(void) override
+    {
+        if (_offset >= _block.Length()) {
+            Types::Blob input;
+            Types::Writer writer(input);
+            writer.Write(_seed);
+            writer.Write(_index);
+            writer.Write(_counter++);
+            _block = *Hash::SHA1().Compute(input);
+            _offset = 0;
+        }
+        const Byte *bytes = _block.Value() + _offset;
+        _offset += 4;
+        return (UInt32(bytes[0]) << 24) | (UInt32(bytes[1]) << 16) | (UInt32(bytes[2]) << 8) | bytes[3];
+    }
+    
+private:
+    Types::Blob _seed;
+    UInt64 _index, _counter;
+    Types::Blob _block;
+    int _offset;
+};
+
+unsigned WorkerCount(void)
+{
+#if MINISSH_THREADS
+    return std::max(std::thread::hardware_concurrency(), 1u);
+#else
+    return 1;
+#endif
+}
+
+// Runs work on the given number of threads, the calling one included, and returns once they've all finished
+void RunWorkers(unsigned count, const std::function<void(void)>& work)
+{
+#if MINISSH_THREADS
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < count; i++)
+        threads.emplace_back(work);
+    work();
+    for (std::thread& thread : threads)
+        thread.join();
+#else
+    work();
+#endif
+}
+
+// A count of candidates as a number
+Maths::BigNumber FromUInt64(UInt64 value)
+{
+    const UInt32 words[] = {UInt32(value), UInt32(value >> 32)};
+    return Maths::BigNumber(words, 2);
+}
+
+/**
+ * Progress of one probable prime search. Windows are handed out in order, and the answer is the first prime in the
+ * lowest numbered window that has one, which is the same however many threads are working.
+ *
+ * Window i holds the odd numbers from base + 2 * i * window on. Candidates that would be too long wrap around to the
+ * bottom of the range, losing 2^(length-1), so every window is worth searching.
+ */
+struct Search
+{
+    Types::Blob seed;
+    Maths::BigNumber base;          // The first candidate
+    UInt64 room;                    // Odd candidates from base before they're too long
+    std::vector<UInt32> residues;   // Of base modulo each small prime
+    std::vector<UInt32> wrap;       // Of 2^(length-1) modulo each small prime
+    std::atomic<UInt64> next;       // The next window to hand out
+    std::atomic<UInt64> found;      // The lowest window known to have a prime
+    Maths::BigNumber prime;
+#if MINISSH_THREADS
+    std::mutex lock;
+#endif
+    
+    Search()
+    :next(0), found(std::numeric_limits<UInt64>::max())
+    {
+    }
+    
+    // Works out the residues once, so windows only need word arithmetic to sieve
+    void Start(IRandomSource& random, int length)
+    {
+        base = RandomOdd(random, length);
+        const Maths::BigNumber odds = ((ONE << length) - base + ONE) >> 1;
+        room = (odds.BitLength() < 64) ? odds.AsUInt64() : std::numeric_limits<UInt64>::max();
+        const Maths::BigNumber half = ONE << (length - 1);
+        for (UInt32 p : SmallPrimes) {
+            residues.push_back(base.Remainder(p));
+            wrap.push_back(half.Remainder(p));
+        }
+    }
+    
+    void Found(UInt64 window, const Maths::BigNumber& value)
+    {
+#if MINISSH_THREADS
+        std::lock_guard<std::mutex> guard(lock);
+#endif
+        if (window < found) {
+            found = window;
+            prime = value;
+        }
+    }
+};
+
+/**
+ * One window of a probable prime search: odd candidates sieved against the small primes and then tested in order, with
+ * the window's own stream for Miller-Rabin. Gives up early if cancelled says to.
+ */
+std::optional<Maths::BigNumber> SearchWindow(const Search& search, UInt64 index, int length, const std::function<bool(void)>& cancelled)
+{
+    HashStream random(search.seed, index);
+    const int iterations = MillerRabinIterations(length);
+    const UInt32 window = std::max(UInt32(length), 64u);   // Odd candidates in each window
+    // The sieve below would reject the small primes themselves, and short lengths can be proven anyway
+    if (length <= 32) {
+        for (UInt32 i = 0; i < window; i++) {
+            Maths::BigNumber candidate = RandomOdd(random, length);
+            if (TrialDivision(candidate))
+                return candidate;
+        }
+        return std::nullopt;
+    }
+    const UInt64 first = index * window;
+    // Candidates from wrapped on have gone past the top, and start again from the bottom
+    const UInt32 wrapped = UInt32(std::min<UInt64>((search.room > first) ? (search.room - first) : 0, window));
+    std::vector<bool> composite(window);
+    auto cross = [&](UInt64 p, UInt64 residue, UInt32 from, UInt32 to){
+        // With residue that of the window's start, its candidate k is divisible by p when k = -residue / 2 (mod p),
+        // and then every p after that
+        UInt64 k = (((p - residue) % p) * ((p + 1) / 2)) % p;
+        if (k < from)
+            k += ((from - k + p - 1) / p) * p;
+        for (; k < to; k += p)
+            composite[k] = true;
+    };
+    for (UInt32 i = 0; i < SmallPrimes.size(); i++) {
+        const UInt64 p = SmallPrimes.values[i];
+        const UInt64 residue = (search.residues[i] + (2 * (first % p))) % p;
+        cross(p, residue, 0, wrapped);
+        cross(p, (residue + p - search.wrap[i]) % p, wrapped, window);
+    }
+    const Maths::BigNumber start = search.base + FromUInt64(2 * first);
+    const Maths::BigNumber half = ONE << (length - 1);
+    for (UInt32 k = 0; k < window; k++) {
+        if (composite[k])
+            continue;
+        if (cancelled())
+            break;
+        Maths::BigNumber candidate = start + Maths::BigNumber(int(2 * k));
+        if (k >= wrapped)
+            candidate -= half;
+        if (candidate.BitLength() != length)
+            break;
+        if (MillerRabin(candidate, iterations, random))
+            return candidate;
+    }
+    return std::nullopt;
+}
+
+std::vector<Maths::BigNumber> ProbablePrimes(IRandomSource& random, const int length, const int count)
+{
+    if (length < 2)
+        throw std::invalid_argument("Primes must be at least two bits long");
+    std::unique_ptr<Search[]> searches(new Search[count]);
+    for (int i = 0; i < count; i++) {
+        searches[i].seed = Maths::BigNumber(SeedBits, random).Data();
+        if (length > 32)
+            searches[i].Start(random, length);
+    }
+    // Workers take a window from each search in turn, so they all progress together. A search stops handing out
+    // windows past the lowest one with a prime, and any already running past it give up.
+    RunWorkers(WorkerCount(), [&]{
+        for (int job = 0, idle = 0; idle < count; job = (job + 1) % count) {
+            Search& search = searches[job];
+            const UInt64 window = search.next++;
+            if (window >= search.found) {
+                idle++;
+                continue;
+            }
+            idle = 0;
+            std::optional<Maths::BigNumber> prime = SearchWindow(search, window, length, [&]{ return search.found < window; });
+            if (prime)
+                search.Found(window, *prime);
+        }
+    });
+    std::vector<Maths::BigNumber> result;
+    for (int i = 0; i < count; i++)
+        result.push_back(searches[i].prime);
+    return result;
+}
+
 }
 
 PrimeSieve::Iterator::Iterator(const PrimeSieve& owner, bool start)
 :_owner(owner)
 {
-    _pos = start ? 2 : _owner._maximum;
+    _pos = (start && (_owner._maximum > 2)) ? 2 : _owner._maximum;
 }
 bool PrimeSieve::Iterator::operator!=(const Iterator& other) const
 {
@@ -62,7 +362,7 @@ PrimeSieve::Iterator& PrimeSieve::Iterator::operator++()
     if (_pos < _owner._maximum) {
         do {
             _pos++;
-        } while ((_pos < _owner._maximum) && !_owner._data[_pos]);
+        } while ((_pos < _owner._maximum) && !_owner.IsPrime(_pos));
     }
     return *this;
 }
@@ -72,21 +372,20 @@ UInt64 PrimeSieve::Iterator::operator*() const
 }
     
 PrimeSieve::PrimeSieve(Maths::BigNumber maximum)
-:_maximum(maximum.AsInt())
+:_maximum(maximum.AsUInt64()), _composite(((_maximum / 2) / 64) + 1)
 {
-    _data = new bool[_maximum];
-    for (UInt64 i = 2; i < _maximum; i++)
-        _data[i] = true;
-    UInt64 max = maximum.SquareRoot().AsInt();
-    for (UInt64 i = 0; i < max; i++)
-        if (_data[i])
-            for (UInt64 j = i * i; j < _maximum; j += i)
-                _data[j] = false;
+    // Even numbers are left out, and only odd multiples of each prime need crossing off
+    for (UInt64 i = 3; (i * i) < _maximum; i += 2)
+        if (IsPrime(i))
+            for (UInt64 j = i * i; j < _maximum; j += 2 * i)
+                _composite[(j / 2) / 64] |= UInt64(1) << ((j / 2) % 64);
 }
-    
-PrimeSieve::~PrimeSieve()
+
+bool PrimeSieve::IsPrime(UInt64 value) const
 {
-    delete[] _data;
+    if ((value < 3) || !(value & 1))
+        return value == 2;
+    return !(_composite[(value / 2) / 64] & (UInt64(1) << ((value / 2) % 64)));
 }
 
 PrimeSieve::Iterator PrimeSieve::begin()
@@ -101,10 +400,33 @@ PrimeSieve::Iterator PrimeSieve::end()
 
 bool TrialDivision(const Maths::BigNumber& value)
 {
-    PrimeSieve primes(value.SquareRoot().AsInt());
-    for (UInt64 prime : primes)
-        if ((value % prime) == 0)
-            return false;
+    if (value < TWO)
+        return false;
+    const UInt64 root = value.SquareRoot().AsUInt64();
+    if (root > std::numeric_limits<UInt32>::max())
+        throw std::invalid_argument("Too large for trial division");
+    const UInt32 limit = UInt32(root);
+    if (!value.TestBit(0))
+        return value == TWO;
+    for (UInt32 prime : SmallPrimes) {
+        if (prime > limit)
+            return true;
+        if (value.Remainder(prime) == 0)
+            return value == int(prime);
+    }
+    // Past the table, try everything the wheel allows rather than sieving: some divisors will be composite, but
+    // that's cheaper than working out which
+    for (UInt64 base = (SmallPrimeLimit / WheelSize) * WheelSize; base <= limit; base += WheelSize) {
+        for (UInt32 spoke : WheelSpokes.spokes) {
+            UInt64 divisor = base + spoke;
+            if (divisor < SmallPrimeLimit)
+                continue;
+            if (divisor > limit)
+                return true;
+            if (value.Remainder(UInt32(divisor)) == 0)
+                return false;
+        }
+    }
     return true;
 }
 
@@ -122,11 +444,12 @@ ST_Random_Prime_Result ST_Random_Prime(const int length, const Maths::BigNumber&
         do {
             // 5. c = Hash(prime_seed) (+) Hash(prime_seed + 1).
             Types::Blob xored = hash.Compute(prime_seed.Data())->XorWith(*hash.Compute((prime_seed + 1).Data()));
-            Maths::BigNumber c(xored.Value(), xored.Length());
+            Maths::BigNumber c(xored.Value(), xored.Length(), false);
             // 6. c = 2^(length-1) + (c mod 2^(length-1))
-            c = (ONE << (length - 1)) + (c % (ONE << (length - 1)));
+            c %= ONE << (length - 1);
+            c.SetBit(length - 1);
             // 7. c = (2 * floor(c/2))+1.
-            c = (TWO * (c / TWO)) + ONE;
+            c.SetBit(0);
             // 8. prime_gen_counter = prime_gen_counter + 1.
             prime_gen_counter++;
             // 9. prime_seed = prime_seed + 2.
@@ -153,46 +476,52 @@ ST_Random_Prime_Result ST_Random_Prime(const int length, const Maths::BigNumber&
     if (!result.status)
         return {false};
     // 16. iterations = ceiling(length / outlen) - 1.
-    int iterations = ceiling_divide(length, int(hash.DigestLength())) - 1;
+    const int outlen = int(hash.DigestLength()) * 8;
+    int iterations = ceiling_divide(length, outlen) - 1;
     // 17. old_counter = prime_gen_counter.
     Maths::BigNumber old_counter = result.prime_gen_counter;
     // 18. x = 0
     Maths::BigNumber x = 0;
     // 19. For i = 0 to iterations do x = x + (hash(prime_seed + i) * 2^(i*outlen)).
-    for (int i = 0; i < iterations; i++) {
+    for (int i = 0; i <= iterations; i++) {
         Types::Blob hashed = *hash.Compute((result.prime_seed + i).Data());
-        Maths::BigNumber value(hashed.Value(), hashed.Length());
-        x += value * (ONE << (i * int(hash.DigestLength())));
+        Maths::BigNumber value(hashed.Value(), hashed.Length(), false);
+        x += value << (i * outlen);
     }
     // 20. prime_seed = prime_seed + iterations + 1.
     result.prime_seed += iterations + 1;
     // 21. x = 2^(length-1)+(x mod 2^(length-1)).
-    Maths::BigNumber pow2 = ONE << (length - 1);
-    x = pow2 + (x % pow2);
+    x %= ONE << (length - 1);
+    x.SetBit(length - 1);
     // 22. t = ceiling(x/(2*c0)).
-    Maths::BigNumber t = ceiling_divide(x, (TWO * c0));
+    const Maths::BigNumber c0_2 = c0 << 1;
+    Maths::BigNumber t = ceiling_divide(x, c0_2);
     do {
+        // 24. c = 2tc0+1. (Worked out first, as step 23 compares it; 2tc0 is even, so setting the low bit adds one.)
+        Maths::BigNumber c = t * c0_2;
+        c.SetBit(0);
         // 23. If (2tc0 + 1 > 2^length), then t=ceiling(2^(length-1)/(2c0)).
-        if ((TWO * t * c0 + ONE) > (ONE << length))
-            t = ceiling_divide(ONE << (length - 1), (TWO * c0));
-        // 24. c = 2tc0+1.
-        Maths::BigNumber c = TWO * t * c0 + Maths::BigNumber(1);
+        if (c.BitLength() > length) {
+            t = ceiling_divide(ONE << (length - 1), c0_2);
+            c = t * c0_2;
+            c.SetBit(0);
+        }
         // 25. prime_gen_counter = prime_gen_counter + 1.
         result.prime_gen_counter++;
         // 26. a = 0.
         Maths::BigNumber a = 0;
         // 27. For i = 0 to iterations do a = a + Hash(prime_seed + i) * 2^(i * outlen)).
-        for (int i = 0; i < iterations; i++) {
+        for (int i = 0; i <= iterations; i++) {
             Types::Blob hashed = *hash.Compute((result.prime_seed + i).Data());
-            Maths::BigNumber value(hashed.Value(), hashed.Length());
-            a += value * ONE << (i * int(hash.DigestLength()));
+            Maths::BigNumber value(hashed.Value(), hashed.Length(), false);
+            a += value << (i * outlen);
         }
         // 28. prime_seed = prime_seed + iterations + 1.
         result.prime_seed += iterations + 1;
         // 29. a = 2 + (a mod (c - 3)).
         a = TWO + (a % (c - 3));
         // 30. z = a^2t mod c.
-        Maths::BigNumber z = a.PowerMod(TWO * t, c);
+        Maths::BigNumber z = a.PowerMod(t << 1, c);
         // 31. If ((1 == GCD(z - 1, c) and (1 = z^c0 mod c)) then
         if ((ONE == (z - ONE).GCD(c)) && (ONE == z.PowerMod(c0, c))) {
             // 31.1 prime = c.
@@ -209,8 +538,84 @@ ST_Random_Prime_Result ST_Random_Prime(const int length, const Maths::BigNumber&
     } while (true);
 }
 
-Maths::BigNumber GetPrime(IRandomSource& random, const int length)
+bool MillerRabin(const Maths::BigNumber& value, const int iterations, IRandomSource& random)
+{
+    if (value < 5)
+        return (value == 2) || (value == 3);
+    if (!value.TestBit(0))
+        return false;
+    // 1. Let a be the largest integer such that 2^a divides w-1.
+    const Maths::BigNumber w_1 = value - ONE;
+    const int a = w_1.GetLowestSetBit();
+    // 2. m = (w-1) / 2^a.
+    const Maths::BigNumber m = w_1 >> a;
+    // 3. wlen = len(w).
+    const int wlen = value.BitLength();
+    const Maths::Montgomery field(value);
+    // 4. For i = 1 to iterations do
+    for (int i = 0; i < iterations; i++) {
+        // 4.1/4.2 Obtain a string b of wlen bits, and if ((b <= 1) or (b >= w-1)), go to step 4.1.
+        Maths::BigNumber b;
+        do {
+            b = Maths::BigNumber(UInt32(wlen), random);
+            b %= ONE << wlen;
+        } while ((b <= ONE) || (b >= w_1));
+        // 4.3 z = b^m mod w.
+        Maths::BigNumber z = field.PowerMod(b, m);
+        // 4.4 If ((z = 1) or (z = w-1)), then go to step 4.7.
+        if ((z == ONE) || (z == w_1))
+            continue;
+        // 4.5 For j = 1 to a-1 do.
+        bool passed = false;
+        for (int j = 1; j < a; j++) {
+            // 4.5.1 z = z^2 mod w.
+            Maths::BigNumber::SquareMod(z, value, z);
+            // 4.5.2 If (z = w-1), then go to step 4.7.
+            if (z == w_1) {
+                passed = true;
+                break;
+            }
+            // 4.5.3 If (z = 1), then go to step 4.6.
+            if (z == ONE)
+                break;
+        }
+        // 4.6 Return COMPOSITE.
+        if (!passed)
+            return false;
+        // 4.7 Continue.
+    }
+    // 5. Return PROBABLY PRIME.
+    return true;
+}
+
+Maths::BigNumber RandomProbablePrime(IRandomSource& random, const int length)
+{
+    return ProbablePrimes(random, length, 1)[0];
+}
+
+std::vector<Maths::BigNumber> GetPrimes(IRandomSource& random, const int length, const int count, Method method)
+{
+    if (method == Method::Probable)
+        return ProbablePrimes(random, length, count);
+    // Each Shawe-Taylor run only depends on its seeds, so they can run side by side with a stream each
+    std::vector<Types::Blob> seeds;
+    for (int i = 0; i < count; i++)
+        seeds.push_back(Maths::BigNumber(SeedBits, random).Data());
+    std::vector<Maths::BigNumber> result(count);
+    std::atomic<int> next(0);
+    RunWorkers(std::min(WorkerCount(), unsigned(count)), [&]{
+        for (int i = next++; i < count; i = next++) {
+            HashStream stream(seeds[i], 0);
+            result[i] = GetPrime(stream, length, Method::Provable);
+        }
+    });
+    return result;
+}
+
+Maths::BigNumber GetPrime(IRandomSource& random, const int length, Method method)
 {
+    if (method == Method::Probable)
+        return RandomProbablePrime(random, length);
     // 160 is the length of a seed for SHA1
     ST_Random_Prime_Result result;
     for (int i = 0; i < 10; i++) {
@@ -8,9 +8,15 @@
 
 #pragma once
 
+#include <vector>
 #include "Maths.h"
 #include "Hash.h"
 
+// Prime searches are spread over all the cores, unless this is defined as 0 for targets without threads
+#ifndef MINISSH_THREADS
+#define MINISSH_THREADS 1
+#endif
+
 namespace minissh::Maths::Primes {
 
 struct ST_Random_Prime_Result {
@@ -27,7 +33,9 @@ class PrimeSieve
 {
 private:
     UInt64 _maximum;
-    bool *_data;
+    std::vector<UInt64> _composite;     // A bit for each odd number
+    
+    bool IsPrime(UInt64 value) const;
 public:
     class Iterator
     {
@@ -42,7 +50,6 @@ public:
     };
     
     PrimeSieve(Maths::BigNumber maximum);
-    ~PrimeSieve();
     
     Iterator begin();
     Iterator end();
@@ -52,7 +59,7 @@ public:
  * Trial Division per FIPS 186.3 section C.7.
  *
  * Prove an integer to be prime by showing that it has no prime factors less than or equal to its square root.
- * Returns true if prime.
+ * Returns true if prime. Only practical for small values, so throws if the square root is over 32 bits.
  */
 bool TrialDivision(const Maths::BigNumber& value);
 
@@ -70,9 +77,39 @@ bool TrialDivision(const Maths::BigNumber& value);
  */
 ST_Random_Prime_Result ST_Random_Prime(const int length, const Maths::BigNumber& input_seed, const Hash::AType& hash);
 
+/**
+ * Miller-Rabin Probabilistic Primality Test, per FIPS 186.4 section C.3.1.
+ *
+ * Tests an odd integer with the given number of random bases. Returns true if probably prime, false if definitely
+ * composite.
+ */
+bool MillerRabin(const Maths::BigNumber& value, const int iterations, IRandomSource& random);
+
+/**
+ * Random probable prime of the given bit length. Odd candidates are taken a window at a time from random starting
+ * points, each window is sieved against a table of small primes, and whatever survives gets the number of Miller-Rabin
+ * rounds FIPS 186.4 table C.3 gives for the length. Windows are searched in parallel, but the result only depends on
+ * what was drawn from the random source.
+ */
+Maths::BigNumber RandomProbablePrime(IRandomSource& random, const int length);
+
+/**
+ * Ways GetPrime can find a prime.
+ */
+enum class Method {
+    Provable,   // Shawe-Taylor, which proves each prime as it constructs it, but is slow
+    Probable,   // Sieved random candidates with Miller-Rabin, which is much quicker
+};
+
 /**
  * Convenience method.
  */
-Maths::BigNumber GetPrime(IRandomSource& random, const int length);
+Maths::BigNumber GetPrime(IRandomSource& random, const int length, Method method = Method::Probable);
+
+/**
+ * Several primes of the same length, such as the two for an RSA key, searched for side by side. The seeds for each are
+ * drawn from the random source up front, so the same source gives the same primes however the work gets scheduled.
+ */
+std::vector<Maths::BigNumber> GetPrimes(IRandomSource& random, const int length, const int count, Method method = Method::Probable);
     
 } // namespace minissh::Maths::Primes
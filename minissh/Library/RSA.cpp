@@ -98,16 +98,15 @@ private:
     static constexpr int COEFFICIENT = 8;
     
     Maths::BigNumber _version;
-    Maths::BigNumber *_numbers[6];
+    Maths::BigNumber *_numbers[9];
 public:
-    KeySetReader(Maths::BigNumber& n, Maths::BigNumber& e, Maths::BigNumber& d, Maths::BigNumber& p, Maths::BigNumber& q)
-    :_numbers{&_version, &n, &e, &d, &p, &q}
+    KeySetReader(Maths::BigNumber& n, Maths::BigNumber& e, Maths::BigNumber& d, Maths::BigNumber& p, Maths::BigNumber& q, Maths::BigNumber& dP, Maths::BigNumber& dQ, Maths::BigNumber& qInv)
+    :_numbers{&_version, &n, &e, &d, &p, &q, &dP, &dQ, &qInv}
     {
     }
     
     void GotNumber(int index, Maths::BigNumber value) override
     {
-        Maths::BigNumber temp;
         switch (index) {
             default:
                 if ((index == VERSION) && (value != 0))
@@ -115,17 +114,19 @@ public:
                 *_numbers[index] = value;
                 break;
             case EXPONENT1:
-                temp = _numbers[EXPONENT_PRIVATE]->PowerMod(1, *_numbers[PRIME1] - 1);
-                if (value != temp)
+                if (value != *_numbers[EXPONENT_PRIVATE] % (*_numbers[PRIME1] - 1))
                     Invalid();
+                *_numbers[index] = value;
                 break;
             case EXPONENT2:
-                if (value != _numbers[EXPONENT_PRIVATE]->PowerMod(1, *_numbers[PRIME2] - 1))
+                if (value != *_numbers[EXPONENT_PRIVATE] % (*_numbers[PRIME2] - 1))
                     Invalid();
+                *_numbers[index] = value;
                 break;
             case COEFFICIENT:
                 if (value != _numbers[PRIME2]->ModularInverse(*_numbers[PRIME1]))
                     Invalid();
+                *_numbers[index] = value;
                 break;
             case 9:
                 Failed();
@@ -159,12 +160,30 @@ Files::Format::KeyFileLoader publicDER(
     }
 );
 
+// value^e mod n for a public exponent. Those that fit a word, which is nearly all of them as 65537 is the norm, take
+// the short square and multiply path.
+Maths::BigNumber PublicPower(const Key& key, const Maths::BigNumber& value, const Maths::BigNumber& e)
+{
+    if (!key.field)
+        return value.PowerMod(e, key.n);
+    if (e.BitLength() <= 32)
+        return key.field->PowerMod(value, UInt32(e.AsUInt64()));
+    return key.field->PowerMod(value, e);
+}
+
 } // namespace
 
-Key::Key(Maths::BigNumber n, Maths::BigNumber e)
+Key::CRT::CRT(const Maths::BigNumber& p, const Maths::BigNumber& q, const Maths::BigNumber& dP, const Maths::BigNumber& dQ, const Maths::BigNumber& qInv, const Maths::BigNumber& e)
+:p(p), q(q), dP(dP), dQ(dQ), qInv(qInv), e(e), pField(p), qField(q)
+{
+}
+
+Key::Key(Maths::BigNumber n, Maths::BigNumber e, std::shared_ptr<const Maths::Montgomery> field, std::shared_ptr<const CRT> crt)
 {
     this->n = n;
     this->e = e;
+    this->field = field;
+    this->crt = crt;
 }
 
 // 5.2.1 RSASP1
@@ -177,19 +196,32 @@ Maths::BigNumber RSASP1(const Key& key, const Maths::BigNumber& m)
     
     // 2. The signature representative s is computed as follows.
     //   a. If the first form (n, d) of K is used, let s = m^d mod n.
-    Maths::BigNumber s = m.PowerMod(key.e, key.n);
+    if (!key.crt)
+        return m.PowerMod(key.e, key.n);
     
     //   b. If the second form (p, q, dP, dQ, qInv) and (r_i, d_i, t_i)
     //      of K is used, proceed as follows:
+    const Key::CRT& crt = *key.crt;
     //     i.    Let s_1 = m^dP mod p and s_2 = m^dQ mod q.
+    Maths::BigNumber s_1 = crt.pField.PowerMod(m, crt.dP);
+    Maths::BigNumber s_2 = crt.qField.PowerMod(m, crt.dQ);
     //     ii.   If u > 2, let s_i = m^(d_i) mod r_i, i = 3, ..., u.
+    //           (Multi-prime keys aren't supported.)
     //     iii.  Let h = (s_1 - s_2) * qInv mod p.
+    Maths::BigNumber h = (s_1 - s_2) % crt.p;
+    if (h < 0)
+        h += crt.p;
+    Maths::BigNumber::MulMod(h, crt.qInv, crt.p, h);
     //     iv.   Let s = s_2 + q * h.
+    Maths::BigNumber s = s_2 + (crt.q * h);
     //     v.    If u > 2, let R = r_1 and for i = 3 to u do
     //         1. Let R = R * r_(i-1).
     //         2. Let h = (s_i - s) * t_i mod r_i.
     //         3. Let s = s + R * h.
-    // TODO!
+    
+    // A fault in either half would give a signature that reveals a factor of n, so check it before letting it out
+    if (PublicPower(key, s, crt.e) != m)
+        throw Exception("signature representative failed verification");
     
     // 3. Output s.
     return s;
@@ -204,7 +236,7 @@ Maths::BigNumber RSAVP1(const Key& key, const Maths::BigNumber& s)
         throw Exception("signature representative out of range");
     
     // 2. Let m = s^e mod n.
-    Maths::BigNumber m = s.PowerMod(key.e, key.n);
+    Maths::BigNumber m = PublicPower(key, s, key.e);
     
     // 3. Output m.
     return m;
@@ -212,8 +244,9 @@ Maths::BigNumber RSAVP1(const Key& key, const Maths::BigNumber& s)
 
 KeySet::KeySet(Maths::IRandomSource& random, int bits)
 {
-    _p = Maths::Primes::GetPrime(random, bits);
-    _q = Maths::Primes::GetPrime(random, bits);
+    std::vector<Maths::BigNumber> primes = Maths::Primes::GetPrimes(random, bits, 2);
+    _p = primes[0];
+    _q = primes[1];
     _n = _p * _q;
     _e = 65537;
     Maths::BigNumber on = (_p - 1) * (_q - 1);
@@ -225,6 +258,16 @@ KeySet::KeySet(Maths::IRandomSource& random, int bits)
         } while (_e >= on);
     }
     _d = _e.ModularInverse(on);
+    _dP = _d % (_p - 1);
+    _dQ = _d % (_q - 1);
+    _qInv = _q.ModularInverse(_p);
+    MakeField();
+    MakeCRT();
+}
+
+void KeySet::MakeCRT(void)
+{
+    _crt = std::make_shared<Key::CRT>(_p, _q, _dP, _dQ, _qInv, _e);
 }
     
 KeyPublic::KeyPublic(Types::Blob load, Files::Format::FileType type)
@@ -250,6 +293,14 @@ KeyPublic::KeyPublic(Types::Blob load, Files::Format::FileType type)
         default:
             throw std::invalid_argument("Unsupported file type");
     }
+    MakeField();
+}
+
+void KeyPublic::MakeField(void)
+{
+    // Keys off the wire may be nonsense; those just don't get a context, and take the slow path
+    if ((_n > 1) && _n.TestBit(0))
+        _field = std::make_shared<Maths::Montgomery>(_n);
 }
 
 Types::Blob KeyPublic::SavePublic(Files::Format::FileType type)
@@ -305,8 +356,12 @@ KeySet::KeySet(Types::Blob load, Files::Format::FileType type)
 {
     if (type != Files::Format::FileType::DER)
         throw std::invalid_argument("Unsupported file type");
-    KeySetReader reader(_n, _e, _d, _p, _q);
+    KeySetReader reader(_n, _e, _d, _p, _q, _dP, _dQ, _qInv);
     Files::DER::Reader::Load(load, reader);
+    if ((_p * _q) != _n)
+        throw std::runtime_error("File invalid; primes don't match modulus");
+    MakeField();
+    MakeCRT();
 }
     
 Types::Blob KeySet::SavePrivate(Files::Format::FileType type)
@@ -333,9 +388,9 @@ Types::Blob KeySet::SavePrivate(Files::Format::FileType type)
     sequence.components.push_back(std::make_shared<Files::DER::Writer::Integer>(_d));
     sequence.components.push_back(std::make_shared<Files::DER::Writer::Integer>(_p));
     sequence.components.push_back(std::make_shared<Files::DER::Writer::Integer>(_q));
-    sequence.components.push_back(std::make_shared<Files::DER::Writer::Integer>(_d.PowerMod(1, _p - 1)));
-    sequence.components.push_back(std::make_shared<Files::DER::Writer::Integer>(_d.PowerMod(1, _q - 1)));
-    sequence.components.push_back(std::make_shared<Files::DER::Writer::Integer>(_q.ModularInverse(_p)));
+    sequence.components.push_back(std::make_shared<Files::DER::Writer::Integer>(_dP));
+    sequence.components.push_back(std::make_shared<Files::DER::Writer::Integer>(_dQ));
+    sequence.components.push_back(std::make_shared<Files::DER::Writer::Integer>(_qInv));
     return sequence.Save();
 }
 
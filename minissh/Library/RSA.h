@@ -10,6 +10,7 @@
 
 #include <memory>
 #include "Types.h"
+#include "Maths.h"
 #include "Hash.h"
 #include "KeyFile.h"
 
@@ -27,10 +28,28 @@ struct Exception : public std::runtime_error
 class Key
 {
 public:
-    Key(Maths::BigNumber n, Maths::BigNumber e);
+    /**
+     * The second form of a private key (RFC3447 section 3.2), which lets signing use two half size exponentiations
+     * instead of one full size one. Built once per key, along with reduction contexts for each prime.
+     */
+    class CRT
+    {
+    public:
+        CRT(const Maths::BigNumber& p, const Maths::BigNumber& q, const Maths::BigNumber& dP, const Maths::BigNumber& dQ, const Maths::BigNumber& qInv, const Maths::BigNumber& e);
+        
+        const Maths::BigNumber p, q;        // Prime factors
+        const Maths::BigNumber dP, dQ;      // Exponents, d mod (p - 1) and d mod (q - 1)
+        const Maths::BigNumber qInv;        // Coefficient, (inverse of q) mod p
+        const Maths::BigNumber e;           // Public exponent, for checking results
+        const Maths::Montgomery pField, qField;
+    };
+    
+    Key(Maths::BigNumber n, Maths::BigNumber e, std::shared_ptr<const Maths::Montgomery> field = nullptr, std::shared_ptr<const CRT> crt = nullptr);
 
     Maths::BigNumber n; // Modulus
     Maths::BigNumber e; // Exponent
+    std::shared_ptr<const Maths::Montgomery> field; // Reduction context for the modulus, if it's been built
+    std::shared_ptr<const CRT> crt; // For private keys, used instead of the exponent if present
 };
 
 class KeyPublic : public Files::Format::IKeyFile
@@ -38,7 +57,7 @@ class KeyPublic : public Files::Format::IKeyFile
 public:
     KeyPublic(Types::Blob load, Files::Format::FileType type);
     
-    Key PublicKey(void) const { return Key(_n, _e); }
+    Key PublicKey(void) const { return Key(_n, _e, _field); }
 
     std::shared_ptr<Transport::IHostKeyAlgorithm> KeyAlgorithm(void) override;
     
@@ -50,6 +69,9 @@ protected:
 
     Maths::BigNumber _n; // Modulus
     Maths::BigNumber _e; // Public Exponent
+    std::shared_ptr<const Maths::Montgomery> _field; // Built once, as every verification needs it
+    
+    void MakeField(void);
 };
     
 class KeySet : public KeyPublic
@@ -58,17 +80,21 @@ public:
     KeySet(Maths::IRandomSource& random, int bits);
     KeySet(Types::Blob load, Files::Format::FileType type);
 
-    Key PrivateKey(void) const { return Key(_n, _d); }
+    Key PrivateKey(void) const { return Key(_n, _d, _field, _crt); }
 
     Types::Blob SavePrivate(Files::Format::FileType type) override;
     std::string GetKeyName(Files::Format::FileType type, bool isPrivate) override;
 
 private:
     Maths::BigNumber _d; // Private Exponent
-    // Unused, but stored on disk, so we keep it around
     Maths::BigNumber _p; // prime1
     Maths::BigNumber _q; // prime2
+    Maths::BigNumber _dP; // exponent1
+    Maths::BigNumber _dQ; // exponent2
+    Maths::BigNumber _qInv; // coefficient
+    std::shared_ptr<const Key::CRT> _crt;
     
+    void MakeCRT(void);
 };
 
 namespace SSA_PKCS1_V1_5 {
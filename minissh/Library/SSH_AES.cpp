@@ -13,45 +13,45 @@
 namespace minissh::Algorithm {
 
 AES_CBC::AES_CBC(Transport::Transport& owner, Transport::Mode mode, int keySize)
-:_cypher(owner.keyExchanger->ExtendKey((mode == Transport::Client) ? owner.keyExchanger->encryptionKeyC2S : owner.keyExchanger->encryptionKeyS2C, keySize / 8))
-,_operation(_cypher, owner.keyExchanger->ExtendKey((mode == Transport::Client) ? owner.keyExchanger->initialisationVectorC2S : owner.keyExchanger->initialisationVectorS2C, keySize / 8))
+:_cypher(owner.keyExchanger->ExtendKey((mode == Transport::Server) ? owner.keyExchanger->encryptionKeyC2S : owner.keyExchanger->encryptionKeyS2C, keySize / 8))
+,_operation(_cypher, owner.keyExchanger->ExtendKey((mode == Transport::Server) ? owner.keyExchanger->initialisationVectorC2S : owner.keyExchanger->initialisationVectorS2C, AES::BlockSize))
 {
 }
 
 int AES_CBC::BlockSize(void)
 {
-    return 16;
+    return AES::BlockSize;
 }
 
-Types::Blob AES_CBC::Encrypt(Types::Blob data)
+void AES_CBC::EncryptInPlace(Byte *data, size_t length)
 {
-    return _operation.Encrypt(data);
+    _operation.EncryptInPlace(data, length);
 }
 
-Types::Blob AES_CBC::Decrypt(Types::Blob data)
+void AES_CBC::DecryptInPlace(Byte *data, size_t length)
 {
-    return _operation.Decrypt(data);
+    _operation.DecryptInPlace(data, length);
 }
 
 AES_CTR::AES_CTR(Transport::Transport& owner, Transport::Mode mode, int keySize)
 :_cypher(owner.keyExchanger->ExtendKey((mode == Transport::Server) ? owner.keyExchanger->encryptionKeyC2S : owner.keyExchanger->encryptionKeyS2C, keySize / 8))
-,_operation(_cypher, owner.keyExchanger->ExtendKey((mode == Transport::Server) ? owner.keyExchanger->initialisationVectorC2S : owner.keyExchanger->initialisationVectorS2C, keySize / 8))
+,_operation(_cypher, owner.keyExchanger->ExtendKey((mode == Transport::Server) ? owner.keyExchanger->initialisationVectorC2S : owner.keyExchanger->initialisationVectorS2C, AES::BlockSize))
 {
 }
 
 int AES_CTR::BlockSize(void)
 {
-    return 16;
+    return AES::BlockSize;
 }
 
-Types::Blob AES_CTR::Encrypt(Types::Blob data)
+void AES_CTR::EncryptInPlace(Byte *data, size_t length)
 {
-    return _operation.Encrypt(data);
+    _operation.EncryptInPlace(data, length);
 }
 
-Types::Blob AES_CTR::Decrypt(Types::Blob data)
+void AES_CTR::DecryptInPlace(Byte *data, size_t length)
 {
-    return _operation.Decrypt(data);
+    _operation.DecryptInPlace(data, length);
 }
     
 } // namespace minissh::Algorithm
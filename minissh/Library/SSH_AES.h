@@ -19,10 +19,10 @@ class AES_CBC : public Transport::IEncryptionAlgorithm
 public:
     AES_CBC(Transport::Transport& owner, Transport::Mode mode, int keySize);
     
-    int BlockSize(void);
+    int BlockSize(void) override;
     
-    Types::Blob Encrypt(Types::Blob data);
-    Types::Blob Decrypt(Types::Blob data);
+    void EncryptInPlace(Byte *data, size_t length) override;
+    void DecryptInPlace(Byte *data, size_t length) override;
     
 private:
     AES _cypher;
@@ -76,10 +76,10 @@ class AES_CTR : public Transport::IEncryptionAlgorithm
 public:
     AES_CTR(Transport::Transport& owner, Transport::Mode mode, int keySize);
     
-    int BlockSize(void);
+    int BlockSize(void) override;
     
-    Types::Blob Encrypt(Types::Blob data);
-    Types::Blob Decrypt(Types::Blob data);
+    void EncryptInPlace(Byte *data, size_t length) override;
+    void DecryptInPlace(Byte *data, size_t length) override;
     
 private:
     AES _cypher;
@@ -17,7 +17,7 @@ HMAC_SHA1::HMAC_SHA1(Transport::Transport& owner, Transport::Mode mode)
     _key = (mode == Transport::Server) ? owner.keyExchanger->integrityKeyC2S : owner.keyExchanger->integrityKeyS2C;
 }
 
-Types::Blob HMAC_SHA1::Generate(Types::Blob packet)
+Types::Blob HMAC_SHA1::Generate(const Types::Blob& packet)
 {
     return HMAC::Calculate(Hash::SHA1(), _key, packet);
 }
@@ -21,7 +21,7 @@ class HMAC_SHA1 : public Transport::IHMACAlgorithm
 public:
     HMAC_SHA1(Transport::Transport& owner, Transport::Mode mode);
     
-    Types::Blob Generate(Types::Blob packet);
+    Types::Blob Generate(const Types::Blob& packet);
     
     int Length(void);
     
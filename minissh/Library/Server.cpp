@@ -40,7 +40,7 @@ public:
             _services[name] = provider;
     }
     
-    void HandlePayload(Types::Blob data) override
+    void HandlePayload(const Types::Blob& data) override
     {
         Types::Reader reader(data);
         switch (reader.ReadByte()) {
@@ -0,0 +1,65 @@
+//
+//  SlidingWindow.h
+//  libminissh
+//
+//  Copyright © 2020 MICE Software. All rights reserved.
+//
+
+#pragma once
+
+#include <algorithm>
+#include "Maths.h"
+
+// The exponent scan shared by the PowerMod implementations. Not part of the library's interface; it's only here so that
+// the benchmark can count the work a scan does, rather than keeping its own copy.
+
+namespace minissh::Maths {
+
+constexpr int MaxWindowSize = 6;
+
+// Window size for sliding window exponentiation, trading the table of odd powers against multiplications saved
+inline int WindowSize(int exponentBits)
+{
+    if (exponentBits > 671)
+        return MaxWindowSize;
+    if (exponentBits > 239)
+        return 5;
+    if (exponentBits > 79)
+        return 4;
+    if (exponentBits > 23)
+        return 3;
+    return 1;
+}
+
+// Left to right sliding window exponentiation, scanning the exponent's bits directly. The caller keeps the accumulator
+// and a table of the odd powers base^1, base^3 ... base^(2^window - 1), with Set and Multiply taking a table index.
+template<class Square, class Set, class Multiply> void SlidingWindow(const BigNumber& exponent, int window, Square square, Set set, Multiply multiply)
+{
+    bool started = false;
+    for (int bit = exponent.BitLength() - 1; bit >= 0;) {
+        if (!exponent[bit]) {
+            if (started)
+                square();
+            bit--;
+            continue;
+        }
+        // Find the longest window starting here that ends in a set bit
+        int low = std::max(bit - window + 1, 0);
+        while (!exponent[low])
+            low++;
+        int value = 0;
+        for (int i = bit; i >= low; i--)
+            value = (value << 1) | (exponent[i] ? 1 : 0);
+        if (started) {
+            for (int i = bit; i >= low; i--)
+                square();
+            multiply(value >> 1);
+        } else {
+            set(value >> 1);
+            started = true;
+        }
+        bit = low - 1;
+    }
+}
+
+} // namespace minissh::Maths
@@ -45,7 +45,7 @@ namespace Server {
                     _mapping.erase(name);
             }
             
-            void HandlePayload(Types::Blob data) override
+            void HandlePayload(const Types::Blob& data) override
             {
                 // Nothing to do, the auth service takes care of all packets
             }
@@ -95,7 +95,7 @@ namespace Server {
         }
     }
 
-    void AuthService::HandlePayload(Types::Blob data)
+    void AuthService::HandlePayload(const Types::Blob& data)
     {
         Types::Reader reader(data);
         switch (reader.ReadByte()) {
@@ -207,7 +207,7 @@ namespace Client {
                 _owner.Enqueue({&_client, name, service, _auth});
             }
             
-            void HandlePayload(Types::Blob data) override
+            void HandlePayload(const Types::Blob& data) override
             {
                 // We don't use this as a message handler
             }
@@ -343,7 +343,7 @@ namespace Client {
         task.authenticator->Query(replier, std::nullopt, false);
     }
 
-    void AuthService::HandlePayload(Types::Blob data)
+    void AuthService::HandlePayload(const Types::Blob& data)
     {
         Types::Reader reader(data);
         switch (reader.ReadByte()) {
@@ -77,7 +77,7 @@ namespace Server {
         
         void ServiceRequested(std::string name, std::optional<std::string> username) override;
 
-        void HandlePayload(Types::Blob data) override;
+        void HandlePayload(const Types::Blob& data) override;
         
         std::shared_ptr<Core::Server::IServiceHandler> AuthServiceHandler(void);
 
@@ -169,7 +169,7 @@ namespace Client {
 
         void Start(void);
         
-        void HandlePayload(Types::Blob data);
+        void HandlePayload(const Types::Blob& data);
         
         void SetAuthenticator(IAuthenticator* authenticator);
         
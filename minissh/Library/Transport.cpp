@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <chrono>
 #include "Transport.h"
 #include "SshNumbers.h"
 #include "Maths.h"
@@ -41,17 +42,23 @@ public:
         return 8;
     }
     
-    Types::Blob Encrypt(Types::Blob data) override
+    void EncryptInPlace(Byte*, size_t) override
     {
-        return data;
     }
     
-    Types::Blob Decrypt(Types::Blob data) override
+    void DecryptInPlace(Byte*, size_t) override
     {
-        return data;
     }
 };
 
+void StoreUInt32(Byte *output, UInt32 value)
+{
+    output[0] = Byte(value >> 24);
+    output[1] = Byte(value >> 16);
+    output[2] = Byte(value >> 8);
+    output[3] = Byte(value);
+}
+
 class NoHmac : public IHMACAlgorithm
 {
 public:
@@ -59,7 +66,7 @@ public:
     {
     }
     
-    Types::Blob Generate(Types::Blob packet) override
+    Types::Blob Generate(const Types::Blob& packet) override
     {
         return Types::Blob();
     }
@@ -159,13 +166,19 @@ namespace Internal {
         
         void HandleMoreData(UInt32 previousLength)
         {
-            int blockSize = _owner.GetIncomingEncryption()->BlockSize();
-            int amount;
-            while (_owner.inputBuffer.Length() >= (amount = NextRead(blockSize))) {
+            while (true) {
                 if (!_packet)
-                    _packet.emplace(Packet(_owner));
+                    _packet.emplace(_owner);
+                int amount = _packet->Requires();
+                if (_owner.inputBuffer.Length() < amount)
+                    return;
                 _packet->Append(_owner.inputBuffer.Value(), amount);
                 _owner.inputBuffer.Strip(0, amount);
+                if (_packet->Invalid()) {
+                    _packet = std::nullopt;
+                    _owner.Panic(Transport::PanicReason::InvalidMessage);
+                    return;
+                }
                 if (_packet->Satisfied()) {
                     _owner.HandlePacket(*_packet);
                     _packet = std::nullopt;
@@ -175,52 +188,33 @@ namespace Internal {
         
     private:
         std::optional<Packet> _packet;
-        
-        UInt32 NextRead(UInt32 blockSize)
-        {
-            if (!_packet)
-                return blockSize;
-            return std::min(_packet->Requires(), blockSize);
-        }
     };
     
-    static std::optional<std::string> CheckGuess(const std::vector<std::string>& client, const std::vector<std::string>& server)
+    template<class Base> bool CheckGuess(const std::vector<std::string>& remoteList, const SharedConfiguration::List<Base>& localList)
     {
-        std::string clientGuess = client.front();
-        if (clientGuess.compare(server.front()) == 0)
-            return clientGuess;
-        return {};
+        // The guess is right if the remote's first choice is also ours
+        if (remoteList.empty())
+            return false;
+        return localList.Find(remoteList.front()) == 0;
     }
     
-    static std::optional<std::string> FindMatch(const std::vector<std::string>& client, const std::vector<std::string>& server)
+    template<class Base> std::optional<int> FindMatch(Mode mode, const std::vector<std::string>& remoteList, const SharedConfiguration::List<Base>& localList)
     {
-        for (auto const& name : client) {
-            for (auto const& sname : server) {
-                if (name.compare(sname) == 0)
-                    return name;
-            }
+        // Lowest ID is our most preferred, so as client take the lowest the server offers, and as server take the
+        // first the client offers that we know.
+        std::optional<int> result;
+        for (auto const& name : remoteList) {
+            std::optional<int> id = localList.Find(name);
+            if (!id)
+                continue;
+            if (mode == Server)
+                return id;
+            if (!result || (*id < *result))
+                result = id;
         }
-        return {};
-    }
-    
-    template<class K, class V> std::vector<K> AllKeys(const std::map<K, V>& input)
-    {
-        std::vector<K> result;
-        result.reserve(input.size());
-        for (auto const& entry : input)
-            result.push_back(entry.first);
         return result;
     }
     
-    template<class C> std::optional<std::string> FindMatch(Mode mode, const std::vector<std::string>& remoteList, const std::map<std::string, C>& localList)
-    {
-        std::vector<std::string> localListKeys = AllKeys(localList);
-        if (mode == Server)
-            return FindMatch(remoteList, localListKeys);
-        else
-            return FindMatch(localListKeys, remoteList);
-    }
-    
     class KexHandler : public IMessageHandler
     {
     private:
@@ -239,17 +233,8 @@ namespace Internal {
             // Cookie
             for (int i = 0; i < 4; i++)
                 writer.Write(UInt32(_owner.random.Random()));
-            // All the lists
-            writer.Write(AllKeys(_owner.configuration.supportedKeyExchanges));
-            writer.Write(AllKeys(_owner.configuration.serverHostKeyAlgorithms));
-            writer.Write(AllKeys(_owner.configuration.encryptionAlgorithms_clientToServer));
-            writer.Write(AllKeys(_owner.configuration.encryptionAlgorithms_serverToClient));
-            writer.Write(AllKeys(_owner.configuration.macAlgorithms_clientToServer));
-            writer.Write(AllKeys(_owner.configuration.macAlgorithms_serverToClient));
-            writer.Write(AllKeys(_owner.configuration.compressionAlgorithms_clientToServer));
-            writer.Write(AllKeys(_owner.configuration.compressionAlgorithms_serverToClient));
-            writer.Write(AllKeys(_owner.configuration.languages_clientToServer));
-            writer.Write(AllKeys(_owner.configuration.languages_serverToClient));
+            // All the lists, already serialised
+            writer.Write(_owner.GetConfiguration().KexInitLists());
             writer.Write(bool(false));  // TODO: guesses
             writer.Write(UInt32(0));    // Reserved
             
@@ -280,7 +265,7 @@ namespace Internal {
             SendKex();
         }
 
-        void HandlePayload(Types::Blob data) override
+        void HandlePayload(const Types::Blob& data) override
         {
             Types::Reader reader(data);
             
@@ -306,38 +291,34 @@ namespace Internal {
                     if (!_expectingInit)
                         SendKex();
                     // Do something about it
-                    std::optional<std::string> kexAlgo;
-                    if (kex_follows) {
-                        kexAlgo = CheckGuess(kexAlgorithms, AllKeys(_owner.configuration.supportedKeyExchanges));
-                        if (!kexAlgo)
-                            _owner.SkipPacket();
-                    }
-                    if (!kexAlgo)
-                        kexAlgo = FindMatch(_mode, kexAlgorithms, _owner.configuration.supportedKeyExchanges);
+                    const SharedConfiguration& configuration = _owner.GetConfiguration();
+                    if (kex_follows && !CheckGuess(kexAlgorithms, configuration.supportedKeyExchanges))
+                        _owner.SkipPacket();
+                    std::optional<int> kexAlgo = FindMatch(_mode, kexAlgorithms, configuration.supportedKeyExchanges);
                     if (!kexAlgo) {
                         _owner.Panic(Transport::PanicReason::NoMatchingAlgorithm);
                         return;
                     }
                     // Find the other algorithms (less complicated)
-                    selectedEncryptionToClient = FindMatch(_mode, encryptionAlgorithms_S2C, _owner.configuration.encryptionAlgorithms_serverToClient);
-                    selectedEncryptionToServer = FindMatch(_mode, encryptionAlgorithms_C2S, _owner.configuration.encryptionAlgorithms_clientToServer);
-                    selectedMACToClient = FindMatch(_mode, mac_S2C, _owner.configuration.macAlgorithms_serverToClient);
-                    selectedMACToServer = FindMatch(_mode, mac_C2S, _owner.configuration.macAlgorithms_clientToServer);
-                    selectedCompressionToClient = FindMatch(_mode, compression_S2C, _owner.configuration.compressionAlgorithms_serverToClient);
-                    selectedCompressionToServer = FindMatch(_mode, compression_C2S, _owner.configuration.compressionAlgorithms_clientToServer);
+                    selectedEncryptionToClient = FindMatch(_mode, encryptionAlgorithms_S2C, configuration.encryptionAlgorithms_serverToClient);
+                    selectedEncryptionToServer = FindMatch(_mode, encryptionAlgorithms_C2S, configuration.encryptionAlgorithms_clientToServer);
+                    selectedMACToClient = FindMatch(_mode, mac_S2C, configuration.macAlgorithms_serverToClient);
+                    selectedMACToServer = FindMatch(_mode, mac_C2S, configuration.macAlgorithms_clientToServer);
+                    selectedCompressionToClient = FindMatch(_mode, compression_S2C, configuration.compressionAlgorithms_serverToClient);
+                    selectedCompressionToServer = FindMatch(_mode, compression_C2S, configuration.compressionAlgorithms_clientToServer);
                     if (!(selectedCompressionToClient && selectedCompressionToServer && selectedEncryptionToClient && selectedEncryptionToServer && selectedMACToClient && selectedMACToServer)) {
                         _owner.Panic(Transport::PanicReason::NoMatchingAlgorithm);
                         return;
                     }
                     // Select host key algorithm (TODO: this should be done in conjunction with kex)
-                    std::optional<std::string> hostKeyAlgo = FindMatch(_mode, hostKeyAlgorithms, _owner.configuration.serverHostKeyAlgorithms);
+                    std::optional<int> hostKeyAlgo = FindMatch(_mode, hostKeyAlgorithms, configuration.serverHostKeyAlgorithms);
                     if (!hostKeyAlgo) {
                         _owner.Panic(Transport::PanicReason::NoMatchingAlgorithm);
                         return;
                     }
                     // Start
-                    _owner.hostKeyAlgorithm = _owner.configuration.serverHostKeyAlgorithms.at(*hostKeyAlgo)->Create(_owner, _mode);
-                    _activeExchanger = _owner.configuration.supportedKeyExchanges.at(*kexAlgo)->Create(_owner, _mode);
+                    _owner.hostKeyAlgorithm = configuration.serverHostKeyAlgorithms.Create(*hostKeyAlgo, _owner, _mode);
+                    _activeExchanger = configuration.supportedKeyExchanges.Create(*kexAlgo, _owner, _mode);
                     _owner.keyExchanger = _activeExchanger;
                     _activeExchanger->Start();
                 }
@@ -350,16 +331,118 @@ namespace Internal {
             }
         }
         
-        std::optional<std::string> selectedEncryptionToServer;
-        std::optional<std::string> selectedEncryptionToClient;
-        std::optional<std::string> selectedMACToServer;
-        std::optional<std::string> selectedMACToClient;
-        std::optional<std::string> selectedCompressionToServer;
-        std::optional<std::string> selectedCompressionToClient;
+        std::optional<int> selectedEncryptionToServer;
+        std::optional<int> selectedEncryptionToClient;
+        std::optional<int> selectedMACToServer;
+        std::optional<int> selectedMACToClient;
+        std::optional<int> selectedCompressionToServer;
+        std::optional<int> selectedCompressionToClient;
     };
     
 } // namespace
 
+namespace {
+
+/**
+ * Stands in for a finished key exchange, so that ciphers and MACs can be created with throwaway keys to be timed.
+ */
+class BenchmarkKeys : public KeyExchanger
+{
+public:
+    BenchmarkKeys(Transport& owner)
+    :KeyExchanger(owner, Server, _sha1)
+    {
+        key = Maths::BigNumber(256, owner.random);
+        exchangeHash = RandomBlob(owner.random, 20);
+        initialisationVectorC2S = RandomBlob(owner.random, 20);
+        initialisationVectorS2C = initialisationVectorC2S;
+        encryptionKeyC2S = RandomBlob(owner.random, 20);
+        encryptionKeyS2C = encryptionKeyC2S;
+        integrityKeyC2S = RandomBlob(owner.random, 20);
+        integrityKeyS2C = integrityKeyC2S;
+    }
+    
+    void Start(void) override {}
+    void HandlePayload(const Types::Blob& data) override {}
+    
+    static Types::Blob RandomBlob(Maths::IRandomSource& random, int length)
+    {
+        Types::Blob result;
+        for (int i = 0; i < length; i++) {
+            Byte value = Byte(random.Random());
+            result.Append(&value, 1);
+        }
+        return result;
+    }
+    
+private:
+    Hash::SHA1 _sha1;
+};
+
+constexpr int BenchmarkLength = 16384;  // A full sized packet
+constexpr int BenchmarkRepeats = 16;
+constexpr int BenchmarkTrials = 5;
+constexpr double BenchmarkMargin = 0.1; // How much cheaper an algorithm must be to go ahead of a preferred one
+
+// The quickest of several runs, after one to warm up caches and any lazily built tables, so that noise and one-off work
+// don't count against an algorithm
+template<class Function> double TimeOf(Function function, int repeats)
+{
+    function();
+    double best = std::numeric_limits<double>::infinity();
+    for (int trial = 0; trial < BenchmarkTrials; trial++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++)
+            function();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+template<class Base, class Function> void Benchmark(const Configuration::AlgorithmList<Base>& list, Transport& owner, std::map<std::string, double>& costs, Function measure)
+{
+    for (auto const& entry : list) {
+        if (costs.find(entry.first) == costs.end())
+            costs[entry.first] = measure(*entry.second->Create(owner, Server));
+    }
+}
+
+} // namespace
+
+void Configuration::RankByBenchmark(Maths::IRandomSource& random, bool includeKeyExchanges)
+{
+    Transport transport(random, Server);
+    transport.keyExchanger = std::make_shared<BenchmarkKeys>(transport);
+    Types::Blob data = BenchmarkKeys::RandomBlob(random, BenchmarkLength);
+    std::map<std::string, double> costs;
+    
+    auto cipher = [&data](IEncryptionAlgorithm& algorithm) {
+        Byte *bytes = data.MutableValue();
+        return TimeOf([&]{ algorithm.EncryptInPlace(bytes, data.Length()); }, BenchmarkRepeats);
+    };
+    Benchmark(encryptionAlgorithms_clientToServer, transport, costs, cipher);
+    Benchmark(encryptionAlgorithms_serverToClient, transport, costs, cipher);
+    encryptionAlgorithms_clientToServer.SortByCost(costs, BenchmarkMargin);
+    encryptionAlgorithms_serverToClient.SortByCost(costs, BenchmarkMargin);
+    
+    auto mac = [&data](IHMACAlgorithm& algorithm) {
+        return TimeOf([&]{ algorithm.Generate(data); }, BenchmarkRepeats);
+    };
+    Benchmark(macAlgorithms_clientToServer, transport, costs, mac);
+    Benchmark(macAlgorithms_serverToClient, transport, costs, mac);
+    macAlgorithms_clientToServer.SortByCost(costs, BenchmarkMargin);
+    macAlgorithms_serverToClient.SortByCost(costs, BenchmarkMargin);
+    
+    if (includeKeyExchanges) {
+        // In server mode, starting the exchange generates our half of it, which is the bulk of the work
+        auto exchange = [](KeyExchanger& algorithm) {
+            return TimeOf([&]{ algorithm.Start(); }, 1);
+        };
+        Benchmark(supportedKeyExchanges, transport, costs, exchange);
+        supportedKeyExchanges.SortByCost(costs, BenchmarkMargin);
+    }
+}
+
 std::string Transport::StringForPanicReason(PanicReason reason)
 {
     switch (reason) {
@@ -379,112 +462,139 @@ std::string Transport::StringForPanicReason(PanicReason reason)
             return "Disconnected due to fatal error";
     }
 }
-    
+
+SharedConfiguration::SharedConfiguration(const Configuration& configuration)
+:supportedKeyExchanges(configuration.supportedKeyExchanges)
+,serverHostKeyAlgorithms(configuration.serverHostKeyAlgorithms)
+,encryptionAlgorithms_clientToServer(configuration.encryptionAlgorithms_clientToServer)
+,encryptionAlgorithms_serverToClient(configuration.encryptionAlgorithms_serverToClient)
+,macAlgorithms_clientToServer(configuration.macAlgorithms_clientToServer)
+,macAlgorithms_serverToClient(configuration.macAlgorithms_serverToClient)
+,compressionAlgorithms_clientToServer(configuration.compressionAlgorithms_clientToServer)
+,compressionAlgorithms_serverToClient(configuration.compressionAlgorithms_serverToClient)
+,languages_clientToServer(configuration.languages_clientToServer)
+,languages_serverToClient(configuration.languages_serverToClient)
+{
+    Types::Writer writer(_kexInitLists);
+    writer.Write(supportedKeyExchanges.Names());
+    writer.Write(serverHostKeyAlgorithms.Names());
+    writer.Write(encryptionAlgorithms_clientToServer.Names());
+    writer.Write(encryptionAlgorithms_serverToClient.Names());
+    writer.Write(macAlgorithms_clientToServer.Names());
+    writer.Write(macAlgorithms_serverToClient.Names());
+    writer.Write(compressionAlgorithms_clientToServer.Names());
+    writer.Write(compressionAlgorithms_serverToClient.Names());
+    writer.Write(languages_clientToServer.Names());
+    writer.Write(languages_serverToClient.Names());
+}
+
+#pragma mark -
+
 Packet::Packet(Transport& owner)
-:_owner(owner)
+:Types::Blob(owner.NewBuffer()), _decrypter(owner.GetIncomingEncryption()), _mac(owner.GetIncomingHMAC())
 {
+    _blockSize = _decrypter->BlockSize();
+    _macLength = _mac->Length();
+    const Byte sequence[SequenceSize] = {0};
+    Blob::Append(sequence, SequenceSize);
 }
 
 void Packet::Append(const Byte *bytes, int length)
 {
     Blob::Append(bytes, length);
-    // Hacky
-    if (_requiredBlocks && (_decodedBlocks >= _requiredBlocks))
+    if (!_packetLength && (Length() >= (SequenceSize + _blockSize))) {
+        _decrypter->DecryptInPlace(MutableValue() + SequenceSize, _blockSize);
+        UInt32 packetLength = Types::Reader(*this, SequenceSize).ReadUInt32();
+        if ((packetLength < 5) || (packetLength > MaximumLength) || ((sizeof(UInt32) + packetLength) % _blockSize)) {
+            _invalid = true;
+            return;
+        }
+        _packetLength = packetLength;
+    }
+    if (!_packetLength || _decrypted)
         return;
-    std::shared_ptr<IEncryptionAlgorithm> decrypter = _owner.GetIncomingEncryption();
-    int blockSize = decrypter->BlockSize();
-    Blob chunk;
-    int offset = _decodedBlocks * blockSize;
-    while ((!_requiredBlocks || (_decodedBlocks < _requiredBlocks)) && ((offset + blockSize) <= Length())) {
-        chunk.Reset();
-        chunk.Append(Value() + offset, blockSize);
-        Blob decoded = decrypter->Decrypt(chunk);
-        memcpy((void*)(Value() + offset), decoded.Value(), blockSize);
-        _decodedBlocks++;
-        if (!_requiredBlocks)
-            _requiredBlocks = (PacketLength() + sizeof(UInt32)) / blockSize;
-        offset += blockSize;
+    int encryptedLength = sizeof(UInt32) + *_packetLength;
+    if (Length() >= (SequenceSize + encryptedLength)) {
+        _decrypter->DecryptInPlace(MutableValue() + SequenceSize + _blockSize, encryptedLength - _blockSize);
+        _decrypted = true;
     }
 }
 
-bool Packet::Satisfied(void)
+bool Packet::Satisfied(void) const
 {
-    std::shared_ptr<IEncryptionAlgorithm> decrypter = _owner.GetIncomingEncryption();
-    std::shared_ptr<IHMACAlgorithm> mac = _owner.GetIncomingHMAC();
-    if (Length() < decrypter->BlockSize())
-        return false;
-    return Length() == PacketLength() + sizeof(UInt32) + mac->Length();
+    return _decrypted && (Length() == (SequenceSize + sizeof(UInt32) + *_packetLength + _macLength));
 }
 
-UInt32 Packet::Requires(void)
+UInt32 Packet::Requires(void) const
 {
-    std::shared_ptr<IEncryptionAlgorithm> decrypter = _owner.GetIncomingEncryption();
-    UInt32 blockSize = decrypter->BlockSize();
-    if (Length() < blockSize)
-        return blockSize;
-    std::shared_ptr<IHMACAlgorithm> mac = _owner.GetIncomingHMAC();
-    return PacketLength() + sizeof(UInt32) + mac->Length() - Length();
+    if (!_packetLength)
+        return SequenceSize + _blockSize - Length();
+    return SequenceSize + sizeof(UInt32) + *_packetLength + _macLength - Length();
 }
 
 UInt32 Packet::PacketLength(void) const
 {
-    return Types::Reader(*this).ReadUInt32();
+    return Types::Reader(*this, SequenceSize).ReadUInt32();
 }
 
 UInt32 Packet::PaddingLength(void) const
 {
-    Types::Reader reader(*this);
+    Types::Reader reader(*this, SequenceSize);
     reader.ReadUInt32();    // Skip packet length
     return reader.ReadByte();
 }
 
 Types::Blob Packet::Payload(void) const
 {
-    std::shared_ptr<IEncryptionAlgorithm> decrypter = _owner.GetIncomingEncryption();
-    if (Length() < decrypter->BlockSize())
-        throw std::runtime_error("Packet does not contain at least a block");
-    Types::Reader reader(*this);
+    if (!_decrypted)
+        throw std::runtime_error("Packet is missing data");
+    Types::Reader reader(*this, SequenceSize);
     UInt32 length = reader.ReadUInt32();
     length -= reader.ReadByte();
     length--;
-    if (Length() < (length + sizeof(UInt32)))
-        throw std::runtime_error("Packet is missing data");
     return reader.ReadBytes((int)length);
 }
 
 Types::Blob Packet::Padding(void) const
 {
-    if (Length() < (PacketLength() + sizeof(UInt32)))
+    if (!_decrypted)
         throw std::runtime_error("Packet does not contain enough data");
-    Types::Reader reader(*this);
+    Types::Reader reader(*this, SequenceSize);
     UInt32 length = reader.ReadUInt32();
-    length -= reader.ReadByte();
-    length--;
-    reader.SkipBytes((int)length);
-    return reader.ReadBytes((int)length);
+    Byte padding = reader.ReadByte();
+    reader.SkipBytes((int)(length - padding - 1));
+    return reader.ReadBytes(padding);
 }
 
 Types::Blob Packet::MAC(void) const
 {
-    std::shared_ptr<IHMACAlgorithm> mac = _owner.GetIncomingHMAC();
-    if (Length() < (PacketLength() + mac->Length() + sizeof(UInt32)))
+    if (!Satisfied())
         throw std::runtime_error("Packet is missing data");
-    Types::Reader reader(*this);
-    UInt32 length = reader.ReadUInt32();
-    reader.SkipBytes((int)length);
-    return reader.ReadBytes(mac->Length());
+    return Slice(Length() - _macLength, _macLength);
 }
 
-bool Packet::CheckMAC(UInt32 sequenceNumber) const
+bool Packet::CheckMAC(UInt32 sequenceNumber)
 {
-    std::shared_ptr<IHMACAlgorithm> mac = _owner.GetIncomingHMAC();
-    if (mac->Length() == 0)
+    if (_macLength == 0)
         return true;
-    Blob macPacket;
-    Types::Writer macWriter(macPacket);
-    macWriter.Write(sequenceNumber);
-    macPacket.Append(Value(), Length() - mac->Length());
-    return MAC().Compare(mac->Generate(macPacket));
+    // The MAC covers the sequence number and the unencrypted packet, which with the sequence number filled in is
+    // exactly what's in the buffer, apart from the MAC itself
+    StoreUInt32(MutableValue(), sequenceNumber);
+    return MAC().Compare(_mac->Generate(Slice(0, Length() - _macLength)));
+}
+
+#pragma mark -
+
+OutgoingPacket::OutgoingPacket(Transport& owner)
+:Types::Blob(owner.NewBuffer())
+{
+    const Byte header[HeaderSize] = {0};
+    Append(header, HeaderSize);
+}
+
+Types::Blob OutgoingPacket::Payload(void) const
+{
+    return Slice(HeaderSize, Length() - HeaderSize);
 }
 
 Transport::Transport(Maths::IRandomSource& source, Mode transportType)
@@ -520,18 +630,30 @@ void Transport::UnregisterForPackets(const Byte *number, int numberLength)
 void Transport::ResetAlgorithms(bool local)
 {
     if (local == (mode == Server)) {
-        encryptionToClient = configuration.encryptionAlgorithms_serverToClient.at(*kexHandler->selectedEncryptionToServer)->Create(*this, Client);
-        macToClient = configuration.macAlgorithms_serverToClient.at(*kexHandler->selectedMACToServer)->Create(*this, Client);
+        encryptionToClient = GetConfiguration().encryptionAlgorithms_serverToClient.Create(*kexHandler->selectedEncryptionToClient, *this, Client);
+        macToClient = GetConfiguration().macAlgorithms_serverToClient.Create(*kexHandler->selectedMACToClient, *this, Client);
         _localKeyCounter++;
     } else {
-        encryptionToServer = configuration.encryptionAlgorithms_clientToServer.at(*kexHandler->selectedEncryptionToClient)->Create(*this, Server);
-        macToServer = configuration.macAlgorithms_clientToServer.at(*kexHandler->selectedMACToClient)->Create(*this, Server);
+        encryptionToServer = GetConfiguration().encryptionAlgorithms_clientToServer.Create(*kexHandler->selectedEncryptionToServer, *this, Server);
+        macToServer = GetConfiguration().macAlgorithms_clientToServer.Create(*kexHandler->selectedMACToServer, *this, Server);
         _remoteKeyCounter++;
     }
     if (_localKeyCounter == _remoteKeyCounter)
         KeysChanged();
 }
 
+void Transport::SetConfiguration(std::shared_ptr<const SharedConfiguration> shared)
+{
+    _configuration = shared;
+}
+
+const SharedConfiguration& Transport::GetConfiguration(void)
+{
+    if (!_configuration)
+        _configuration = std::make_shared<SharedConfiguration>(configuration);
+    return *_configuration;
+}
+
 void Transport::KeysChanged(void)
 {
     // We don't need to do anything here - client can hook it to detect when it can start authentication
@@ -606,7 +728,7 @@ void Transport::InitialiseSSH(std::string remoteVersion, const std::vector<std::
     _handler = std::make_shared<Internal::BlockReceiver>(*this);
 }
 
-void Transport::HandlePacket(Packet block)
+void Transport::HandlePacket(Packet& block)
 {
     if (_toSkip) {
         _toSkip--;
@@ -638,23 +760,28 @@ void Transport::HandlePacket(Packet block)
     _remoteSeqCounter++;
 }
 
-void Transport::Send(Types::Blob payload)
+void Transport::Send(const Types::Blob& payload)
+{
+    OutgoingPacket packet(*this);
+    packet.Append(payload.Value(), payload.Length());
+    Send(packet);
+}
+
+void Transport::Send(OutgoingPacket& packet)
 {
     std::shared_ptr<IEncryptionAlgorithm> encrypter = GetOutgoingEncryption();
+    std::shared_ptr<IHMACAlgorithm> hmac = GetOutgoingHMAC();
     int blockSize = encrypter->BlockSize();
+    int payloadLength = packet.Length() - OutgoingPacket::HeaderSize;
 
     // TODO: compression (payload = Compress(payload))
     
     int minimumPadding = 4;    // Minimum 4 padding
-    int minimumLength = /*packet_length*/ 4 + /*padding_length*/ 1 + payload.Length() + minimumPadding;
+    int minimumLength = /*packet_length*/ 4 + /*padding_length*/ 1 + payloadLength + minimumPadding;
     minimumPadding += blockSize - (minimumLength % blockSize);
     int padding = minimumPadding;
     
-    Types::Blob packet;
     Types::Writer writer(packet);
-    writer.Write(UInt32(1 + payload.Length() + padding));
-    writer.Write(Byte(padding));
-    writer.Write(payload);
     for (int i = padding; i != 0;) {
         UInt32 aRandom = sessionID ? random.Random() : 0;
         if (i > 4) {
@@ -669,31 +796,36 @@ void Transport::Send(Types::Blob payload)
             i--;
         }
     }
+    Byte *header = packet.MutableValue();
+    StoreUInt32(header, _localSeqCounter);
+    StoreUInt32(header + 4, UInt32(1 + payloadLength + padding));
+    header[8] = Byte(padding);
 
     DEBUG_LOG_TRANSFER(("%c> message %s[%i]: %i bytes (%i total)\n", Local(),
-        StringForSSHNumber(SSHMessages(payload.Value()[0])).c_str(), payload.Value()[0],
-        payload.Length(), packet.Length() + GetOutgoingHMAC()->Length()));
+        StringForSSHNumber(SSHMessages(header[OutgoingPacket::HeaderSize])).c_str(), header[OutgoingPacket::HeaderSize],
+        payloadLength, packet.Length() - 4 + hmac->Length()));
 #ifdef DEBUG_LOG_CONTENT
-    payload.DebugDump();
+    packet.Payload().DebugDump();
 #endif
     
-    // Encrypt the packet (a block at a time, as per the encryption algorithm) and transmit it
-    for (int i = 0; i < packet.Length(); i += blockSize) {
-        Types::Blob result = encrypter->Encrypt(Types::Blob(packet.Value() + i, blockSize));
-        _delegate->Send(result.Value(), result.Length());
-    }
+    // The MAC covers the sequence number and the unencrypted packet, which is exactly what's in the buffer so far
+    Types::Blob macData = hmac->Generate(packet);
+
+    // Encrypt the packet in place
+    encrypter->EncryptInPlace(packet.MutableValue() + 4, packet.Length() - 4);
 
-    // Generate the MAC
-    Types::Blob macPacket;
-    Types::Writer macWriter(macPacket);
-    macWriter.Write(_localSeqCounter);
-    macWriter.Write(packet);
-    Types::Blob macData = GetOutgoingHMAC()->Generate(macPacket);
-    _delegate->Send(macData.Value(), macData.Length());
+    // Transmit the lot, leaving off the sequence number
+    packet.Append(macData.Value(), macData.Length());
+    _delegate->Send(packet.Value() + 4, packet.Length() - 4);
 
     _localSeqCounter++;
 }
 
+Types::Blob Transport::NewBuffer(void)
+{
+    return bufferPool ? bufferPool->Get() : Types::Blob();
+}
+
 void Transport::Panic(PanicReason r)
 {
     _delegate->Failed(r);
@@ -762,7 +894,7 @@ Types::Blob KeyExchanger::ExtendKey(Types::Blob baseKey, UInt32 requiredLength)
     
     // Shrink instead?
     if (requiredLength < baseKey.Length())
-        return Types::Blob(baseKey.Value(), requiredLength);
+        return baseKey.Slice(0, requiredLength);
     
     // Construct K || H || K1 (which is K2)
     Types::Blob extra;
@@ -780,7 +912,7 @@ Types::Blob KeyExchanger::ExtendKey(Types::Blob baseKey, UInt32 requiredLength)
         writer.Write(Kn);
     } while (result.Length() < requiredLength);
     
-    return result;
+    return result.Slice(0, requiredLength);
 }
 
 } // namespace minissh::Transport
@@ -9,6 +9,8 @@
 #pragma once
 
 #include <map>
+#include <algorithm>
+#include <limits>
 #include "Types.h"
 #include "Hash.h"
 #include "KeyFile.h"
@@ -57,7 +59,7 @@ class IMessageHandler
 public:
     virtual ~IMessageHandler() = default;
     
-    virtual void HandlePayload(Types::Blob data) = 0;
+    virtual void HandlePayload(const Types::Blob& data) = 0;
 };
 
 /**
@@ -121,8 +123,23 @@ public:
     
     virtual int BlockSize(void) = 0;
     
-    virtual Types::Blob Encrypt(Types::Blob data) = 0;
-    virtual Types::Blob Decrypt(Types::Blob data) = 0;
+    // Encrypt or decrypt data in place. The length can be any multiple of the block size.
+    virtual void EncryptInPlace(Byte *data, size_t length) = 0;
+    virtual void DecryptInPlace(Byte *data, size_t length) = 0;
+    
+    // Convenience wrappers, returning a processed copy of the data
+    Types::Blob Encrypt(const Types::Blob& data)
+    {
+        Types::Blob result(data.Value(), data.Length());
+        EncryptInPlace(result.MutableValue(), result.Length());
+        return result;
+    }
+    Types::Blob Decrypt(const Types::Blob& data)
+    {
+        Types::Blob result(data.Value(), data.Length());
+        DecryptInPlace(result.MutableValue(), result.Length());
+        return result;
+    }
 };
 
 /**
@@ -133,7 +150,7 @@ class IHMACAlgorithm
 public:
     virtual ~IHMACAlgorithm() = default;
     
-    virtual Types::Blob Generate(Types::Blob packet) = 0;
+    virtual Types::Blob Generate(const Types::Blob& packet) = 0;
     virtual int Length(void) = 0;
 };
 
@@ -171,16 +188,98 @@ public:
         virtual std::shared_ptr<Base> Create(Transport& owner, Mode mode) const = 0;
     };
     
-    std::map<std::string, std::shared_ptr<IInstantiator<KeyExchanger>>> supportedKeyExchanges;
-    std::map<std::string, std::shared_ptr<IInstantiator<IHostKeyAlgorithm>>> serverHostKeyAlgorithms;
-    std::map<std::string, std::shared_ptr<IInstantiator<IEncryptionAlgorithm>>> encryptionAlgorithms_clientToServer;
-    std::map<std::string, std::shared_ptr<IInstantiator<IEncryptionAlgorithm>>> encryptionAlgorithms_serverToClient;
-    std::map<std::string, std::shared_ptr<IInstantiator<IHMACAlgorithm>>> macAlgorithms_clientToServer;
-    std::map<std::string, std::shared_ptr<IInstantiator<IHMACAlgorithm>>> macAlgorithms_serverToClient;
-    std::map<std::string, std::shared_ptr<IInstantiator<ICompression>>> compressionAlgorithms_clientToServer;
-    std::map<std::string, std::shared_ptr<IInstantiator<ICompression>>> compressionAlgorithms_serverToClient;
-    std::map<std::string, std::shared_ptr<IInstantiator<ILanguage>>> languages_clientToServer;
-    std::map<std::string, std::shared_ptr<IInstantiator<ILanguage>>> languages_serverToClient;
+    /**
+     * List of supported algorithms of one kind, in order of preference. Algorithms are advertised in this order, and
+     * the client's order decides which is used. By default that's the order they were added in.
+     */
+    template<class Base> class AlgorithmList
+    {
+    public:
+        typedef std::pair<std::string, std::shared_ptr<IInstantiator<Base>>> Entry;
+        
+        // Adds an algorithm as the least preferred. If the name is already present, it's left as it was.
+        void Add(const std::string& name, std::shared_ptr<IInstantiator<Base>> instantiator)
+        {
+            if (!Contains(name))
+                _entries.push_back(Entry(name, instantiator));
+        }
+        
+        void Remove(const std::string& name)
+        {
+            _entries.erase(std::remove_if(_entries.begin(), _entries.end(), [&name](const Entry& entry){ return entry.first == name; }), _entries.end());
+        }
+        
+        bool Contains(const std::string& name) const
+        {
+            return std::any_of(_entries.begin(), _entries.end(), [&name](const Entry& entry){ return entry.first == name; });
+        }
+        
+        // Moves the named algorithms to the front, in the order given. Names not in the list are ignored, and the
+        // remaining algorithms keep their relative order after them.
+        void Prefer(const std::vector<std::string>& names)
+        {
+            std::vector<Entry> ordered;
+            ordered.reserve(_entries.size());
+            for (auto const& name : names) {
+                auto it = std::find_if(_entries.begin(), _entries.end(), [&name](const Entry& entry){ return entry.first == name; });
+                if (it != _entries.end()) {
+                    ordered.push_back(*it);
+                    _entries.erase(it);
+                }
+            }
+            ordered.insert(ordered.end(), _entries.begin(), _entries.end());
+            _entries.swap(ordered);
+        }
+        
+        // Reorders by a cost for each name, cheapest first. An algorithm only moves ahead of a more preferred one if
+        // it's cheaper by more than margin (a fraction of its cost), so near ties keep the current order. Names with no
+        // cost go last, in their current order.
+        void SortByCost(const std::map<std::string, double>& costs, double margin = 0)
+        {
+            auto cost = [&costs](const Entry& entry) {
+                auto it = costs.find(entry.first);
+                return (it == costs.end()) ? std::numeric_limits<double>::infinity() : it->second;
+            };
+            std::vector<Entry> ordered;
+            ordered.reserve(_entries.size());
+            for (auto const& entry : _entries) {
+                // Step back past everything this is clearly cheaper than, stopping at the first it isn't
+                auto position = ordered.end();
+                while ((position != ordered.begin()) && ((cost(entry) * (1 + margin)) < cost(*(position - 1))))
+                    position--;
+                ordered.insert(position, entry);
+            }
+            _entries.swap(ordered);
+        }
+        
+        int Count(void) const { return int(_entries.size()); }
+        typename std::vector<Entry>::const_iterator begin(void) const { return _entries.begin(); }
+        typename std::vector<Entry>::const_iterator end(void) const { return _entries.end(); }
+        
+    private:
+        std::vector<Entry> _entries;
+    };
+    
+    AlgorithmList<KeyExchanger> supportedKeyExchanges;
+    AlgorithmList<IHostKeyAlgorithm> serverHostKeyAlgorithms;
+    AlgorithmList<IEncryptionAlgorithm> encryptionAlgorithms_clientToServer;
+    AlgorithmList<IEncryptionAlgorithm> encryptionAlgorithms_serverToClient;
+    AlgorithmList<IHMACAlgorithm> macAlgorithms_clientToServer;
+    AlgorithmList<IHMACAlgorithm> macAlgorithms_serverToClient;
+    AlgorithmList<ICompression> compressionAlgorithms_clientToServer;
+    AlgorithmList<ICompression> compressionAlgorithms_serverToClient;
+    AlgorithmList<ILanguage> languages_clientToServer;
+    AlgorithmList<ILanguage> languages_serverToClient;
+    
+    /**
+     * Time each registered cipher and MAC on this machine, and reorder the lists so the cheapest is preferred. The
+     * configured order still breaks ties: an algorithm only goes ahead of a preferred one if it's clearly quicker. Key
+     * exchanges are only timed if asked, as the quickest group is usually the weakest. Meant to be called once at
+     * startup; it takes a moment, longer if key exchanges are included. Only a client's ranking decides what's
+     * negotiated, as the first of the client's algorithms that the server also supports is the one used (RFC4253
+     * section 7.1); ranking a server's configuration only reorders what it advertises.
+     */
+    void RankByBenchmark(Maths::IRandomSource& random, bool includeKeyExchanges = false);
     
     /**
      * Template class to automate adding supported algorithms to a Configuration object.
@@ -197,13 +296,80 @@ public:
             }
         };
     public:
-        static void Add(std::map<std::string, std::shared_ptr<IInstantiator<Base>>> &list)
+        static void Add(AlgorithmList<Base> &list)
         {
-            list.insert(std::pair<std::string, std::shared_ptr<IInstantiator<Base>>>(std::string(Class::Name), std::make_shared<Factory>()));
+            list.Add(std::string(Class::Name), std::make_shared<Factory>());
         }
     };
 };
-    
+
+/**
+ * Frozen form of a Configuration, built once and then shared by any number of transports. Each algorithm is known by
+ * its index in its list, so negotiation compares integers, and the KEXINIT name-lists are serialised up front.
+ */
+class SharedConfiguration
+{
+public:
+    /**
+     * An immutable list of algorithms of one kind, in order of preference.
+     */
+    template<class Base> class List
+    {
+    public:
+        List(const Configuration::AlgorithmList<Base>& algorithms)
+        {
+            _names.reserve(algorithms.Count());
+            _instantiators.reserve(algorithms.Count());
+            for (auto const& entry : algorithms) {
+                _ids.insert(std::pair<std::string, int>(entry.first, int(_names.size())));
+                _names.push_back(entry.first);
+                _instantiators.push_back(entry.second);
+            }
+        }
+
+        int Count(void) const { return int(_names.size()); }
+        const std::vector<std::string>& Names(void) const { return _names; }
+        const std::string& Name(int id) const { return _names.at(id); }
+
+        std::optional<int> Find(const std::string& name) const
+        {
+            auto it = _ids.find(name);
+            if (it == _ids.end())
+                return {};
+            return it->second;
+        }
+
+        std::shared_ptr<Base> Create(int id, Transport& owner, Mode mode) const
+        {
+            return _instantiators.at(id)->Create(owner, mode);
+        }
+
+    private:
+        std::vector<std::string> _names;
+        std::vector<std::shared_ptr<Configuration::IInstantiator<Base>>> _instantiators;
+        std::map<std::string, int> _ids;
+    };
+
+    SharedConfiguration(const Configuration& configuration);
+
+    const List<KeyExchanger> supportedKeyExchanges;
+    const List<IHostKeyAlgorithm> serverHostKeyAlgorithms;
+    const List<IEncryptionAlgorithm> encryptionAlgorithms_clientToServer;
+    const List<IEncryptionAlgorithm> encryptionAlgorithms_serverToClient;
+    const List<IHMACAlgorithm> macAlgorithms_clientToServer;
+    const List<IHMACAlgorithm> macAlgorithms_serverToClient;
+    const List<ICompression> compressionAlgorithms_clientToServer;
+    const List<ICompression> compressionAlgorithms_serverToClient;
+    const List<ILanguage> languages_clientToServer;
+    const List<ILanguage> languages_serverToClient;
+
+    // All ten name-lists, serialised in KEXINIT order
+    const Types::Blob& KexInitLists(void) const { return _kexInitLists; }
+
+private:
+    Types::Blob _kexInitLists;
+};
+
 /**
  * Utility "No compression" compression implementation
  */
@@ -221,7 +387,9 @@ public:
 };
 
 /**
- * Container for a packet for passing over an SSH transport.
+ * Container for a packet received over an SSH transport. The first block is decrypted as soon as it arrives, to learn
+ * the length, and the rest of the packet is decrypted in place in one go. Space for the sequence number is kept in
+ * front of the packet, so that the MAC can be checked without copying it.
  */
 class Packet : public Types::Blob
 {
@@ -230,8 +398,9 @@ public:
     
     void Append(const Byte *bytes, int length);
     
-    bool Satisfied(void);   // True when the whole packet is in and decoded
-    UInt32 Requires(void);
+    bool Satisfied(void) const;     // True when the whole packet is in and decoded
+    bool Invalid(void) const { return _invalid; }   // True if the length makes no sense, e.g. it didn't decrypt
+    UInt32 Requires(void) const;    // Bytes to read before the packet can make progress (the first block, then the rest)
     
     UInt32 PacketLength(void) const;
     UInt32 PaddingLength(void) const;
@@ -239,12 +408,32 @@ public:
     Types::Blob Padding(void) const;
     Types::Blob MAC(void) const;
     
-    bool CheckMAC(UInt32 sequenceNumber) const;
+    bool CheckMAC(UInt32 sequenceNumber);
     
 private:
-    Transport &_owner;
-    int _decodedBlocks = 0;
-    int _requiredBlocks = 0;
+    static constexpr int SequenceSize = 4;
+    static constexpr UInt32 MaximumLength = 256 * 1024;
+    
+    std::shared_ptr<IEncryptionAlgorithm> _decrypter;
+    std::shared_ptr<IHMACAlgorithm> _mac;
+    int _blockSize, _macLength;
+    std::optional<UInt32> _packetLength;    // Known once the first block is decrypted
+    bool _decrypted = false;
+    bool _invalid = false;
+};
+
+/**
+ * Container for building a packet to send over an SSH transport. The payload is written after space reserved for the
+ * header (and the sequence number, which the MAC covers), so the transport can pad, MAC and encrypt it in place.
+ */
+class OutgoingPacket : public Types::Blob
+{
+public:
+    static constexpr int HeaderSize = /*sequence_number*/ 4 + /*packet_length*/ 4 + /*padding_length*/ 1;
+    
+    OutgoingPacket(Transport& owner);
+    
+    Types::Blob Payload(void) const;
 };
 
 /**
@@ -283,12 +472,14 @@ public:
     std::shared_ptr<Internal::KexHandler> kexHandler;
     Types::Blob inputBuffer;
     void InitialiseSSH(std::string remoteVersion, const std::vector<std::string>& message);
-    void HandlePacket(Packet block);
+    void HandlePacket(Packet& block);
     void ResetAlgorithms(bool local);
     virtual void KeysChanged(void);
     std::shared_ptr<Files::Format::IKeyFile> GetHostKey(void) { return _delegate->GetHostKey(); }
     
-    void Send(Types::Blob payload);
+    void Send(const Types::Blob& payload);
+    void Send(OutgoingPacket& packet);  // Consumes the packet, which is padded, encrypted and transmitted in place
+    Types::Blob NewBuffer(void);    // Empty blob for building a packet in, from the buffer pool if there is one
     void Panic(PanicReason r);
     void SkipPacket(void);
     
@@ -317,8 +508,12 @@ public:
     
     // Supported
     Mode mode;
-    Configuration configuration;
+    Configuration configuration;   // Frozen when the transport starts, unless a shared configuration was supplied
     Maths::IRandomSource &random;
+    std::shared_ptr<Types::BufferPool> bufferPool;  // Optional, to recycle packet buffers rather than allocating them
+    
+    void SetConfiguration(std::shared_ptr<const SharedConfiguration> shared);  // Use a configuration built once for many transports
+    const SharedConfiguration& GetConfiguration(void);
     
     // Control
     void Start(void);
@@ -352,6 +547,7 @@ public:
 
 private:
     IDelegate *_delegate = nullptr;
+    std::shared_ptr<const SharedConfiguration> _configuration;
     std::shared_ptr<Internal::Handler> _handler;
     IMessageHandler *_packeters[256];
     int _toSkip;
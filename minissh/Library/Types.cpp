@@ -9,18 +9,18 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <memory.h>
+#include <algorithm>
 #include "Types.h"
 #include "Maths.h"
 
-#define GRAIN           128
-
 namespace minissh::Types {
 
 namespace {
     
-int GETSIZE(int x)
+int GrowSize(int current, int required)
 {
-    return x + GRAIN - (x % GRAIN);
+    // Grow geometrically, so that building up a blob by appending is amortised linear time
+    return std::max(current * 2, required);
 }
 
 UInt32 Swap32(UInt32 value)
@@ -76,84 +76,204 @@ int MatchCharacters(const Byte *buffer, int bufferLength, const Byte *match, int
     return -1;
 }
 
+thread_local UInt64 bytesCopied = 0;
+
+// Blob's copying all goes through these, so that it can be measured
+void CopyBytes(void *destination, const void *source, int length)
+{
+    bytesCopied += length;
+    memcpy(destination, source, length);
+}
+
+void MoveBytes(void *destination, const void *source, int length)
+{
+    bytesCopied += length;
+    memmove(destination, source, length);
+}
+
+std::shared_ptr<Byte> Allocate(int size)
+{
+    return std::shared_ptr<Byte>(new Byte[size], std::default_delete<Byte[]>());
+}
+
 } // namespace
 
 void Blob::DebugDump(void)
 {
-    RawDebugDump(_value, _len);
+    RawDebugDump(Value(), _len);
+}
+
+UInt64 Blob::BytesCopied(void)
+{
+    return bytesCopied;
 }
 
 #pragma mark -
 #pragma mark Blob
 
 Blob::Blob()
+:_offset(0), _len(0), _max(InlineSize)
 {
-    _max = GRAIN;
-    _value = new Byte[_max];
-    _len = 0;
 }
 
 Blob::Blob(const Byte* data, int length)
-:_max(length + GRAIN), _len(length)
+:_offset(0), _len(length), _max(InlineSize)
+{
+    if (_len > InlineSize) {
+        _max = _len;
+        _buffer = Allocate(_max);
+    }
+    CopyBytes(Storage(), data, _len);
+}
+
+Blob::Blob(const std::shared_ptr<Byte>& buffer, int size)
+:_buffer(buffer), _offset(0), _len(0), _max(size)
 {
-    _value = new Byte[_max];
-    memcpy(_value, data, _len);
 }
 
 Blob::Blob(const Blob& other)
-:_max(other._max), _len(other._len)
+:_buffer(other._buffer), _offset(other._offset), _len(other._len), _max(other._max)
 {
-    _value = new Byte[_max];
-    memcpy(_value, other._value, _len);
+    if (!_buffer) {
+        _offset = 0;
+        CopyBytes(_inline, other.Value(), _len);
+    }
+}
+
+Blob::Blob(Blob&& other) noexcept
+:_buffer(std::move(other._buffer)), _offset(other._offset), _len(other._len), _max(other._max)
+{
+    if (!_buffer)
+        CopyBytes(_inline + _offset, other._inline + _offset, _len);
+    other._offset = 0;
+    other._len = 0;
+    other._max = InlineSize;
+}
+
+Blob& Blob::operator=(Blob other)
+{
+    std::swap(_buffer, other._buffer);
+    std::swap(_offset, other._offset);
+    std::swap(_max, other._max);
+    std::swap(_len, other._len);
+    if (!_buffer) {
+        bytesCopied += _offset + _len;
+        std::swap(_inline, other._inline);
+    }
+    return *this;
 }
 
 std::string Blob::AsString(void) const
 {
-    return std::string(reinterpret_cast<char*>(_value), _len);
+    return std::string(reinterpret_cast<const char*>(Value()), _len);
 }
 
 Blob Blob::XorWith(const Blob& other) const
 {
     if (_len != other._len)
         throw std::invalid_argument("Blobs are not same length");
-    Blob result(_value, _len);
+    Blob result(Value(), _len);
+    Byte *output = result.MutableValue();
+    const Byte *input = other.Value();
     for (int i = 0; i < _len; i++)
-        result._value[i] ^= other._value[i];
+        output[i] ^= input[i];
     return result;
 }
 
 Blob::~Blob()
 {
-    delete[] _value;
+}
+
+Byte* Blob::Storage(void) const
+{
+    return _buffer ? _buffer.get() : const_cast<Byte*>(_inline);
+}
+
+bool Blob::Contains(const Byte *bytes) const
+{
+    const Byte *storage = Storage();
+    return (bytes >= storage) && (bytes < (storage + _max));
+}
+
+bool Blob::Shared(void) const
+{
+    return _buffer.use_count() > 1;
+}
+
+void Blob::Reallocate(int size, const Byte *extra, int extraLength)
+{
+    // Move our contents (and optionally some more) into storage only we own. The old buffer is released last, in
+    // case the extra data came from it.
+    if (size <= InlineSize) {
+        Byte merged[InlineSize];
+        CopyBytes(merged, Value(), _len);
+        if (extraLength)
+            CopyBytes(merged + _len, extra, extraLength);
+        CopyBytes(_inline, merged, _len + extraLength);
+        _buffer.reset();
+        _max = InlineSize;
+    } else {
+        std::shared_ptr<Byte> newData = Allocate(size);
+        CopyBytes(newData.get(), Value(), _len);
+        if (extraLength)
+            CopyBytes(newData.get() + _len, extra, extraLength);
+        _buffer = newData;
+        _max = size;
+    }
+    _offset = 0;
+    _len += extraLength;
 }
 
 void Blob::Reset(void)
 {
+    if (Shared()) {
+        // No point copying the contents just to throw them away
+        _buffer.reset();
+        _max = InlineSize;
+    }
+    _offset = 0;
     _len = 0;
 }
 
 void Blob::Append(const Byte *bytes, int length)
 {
-    if ((_len + length) > _max) {
-        _max = GETSIZE(_len + length);
-        Byte *newData = new Byte[_max];
-        memcpy(newData, _value, _len);
-        delete[] _value;
-        _value = newData;
+    if (!Shared() && ((_offset + _len + length) > _max) && ((_len + length) <= _max) && !Contains(bytes)) {
+        // There's room if the unconsumed data is moved back to the start, which is cheaper than a new buffer
+        MoveBytes(Storage(), Storage() + _offset, _len);
+        _offset = 0;
+    }
+    if (Shared() || ((_offset + _len + length) > _max)) {
+        Reallocate(GrowSize(_len, _len + length), bytes, length);
+        return;
     }
-    memcpy(_value + _len, bytes, length);
+    CopyBytes(Storage() + _offset + _len, bytes, length);
     _len += length;
 }
 
 void Blob::Strip(int location, int length)
 {
-    memmove(_value + location, _value + location + length, _len - (location + length));
+    if (location == 0) {
+        // Just narrow the view, so that consuming from the front doesn't move any data
+        _offset += length;
+        if ((length == _len) && !Shared())
+            _offset = 0;    // Everything consumed, so start again at the beginning of the storage
+    } else if ((location + length) != _len) {
+        Byte *value = MutableValue();
+        MoveBytes(value + location, value + location + length, _len - (location + length));
+    }
     _len -= length;
 }
 
+Byte* Blob::MutableValue(void)
+{
+    if (Shared())
+        Reallocate(_len, nullptr, 0);
+    return Storage() + _offset;
+}
+
 const Byte* Blob::Value(void) const
 {
-    return _value;
+    return Storage() + _offset;
 }
 
 int Blob::Length(void) const
@@ -167,13 +287,23 @@ bool Blob::Compare(const Blob& other) const
         return false;
     if (_len == 0)
         return true;
-    return memcmp(_value, other._value, _len) == 0;
+    return memcmp(Value(), other.Value(), _len) == 0;
 }
 
 Blob Blob::Copy(void) const
 {
     Blob result;
-    result.Append(_value, _len);
+    result.Append(Value(), _len);
+    return result;
+}
+
+Blob Blob::Slice(int offset, int length) const
+{
+    if ((offset < 0) || (length < 0) || ((offset + length) > _len))
+        throw std::out_of_range("Slice out of range");
+    Blob result(*this);
+    result._offset += offset;
+    result._len = length;
     return result;
 }
 
@@ -202,30 +332,159 @@ std::optional<std::string> Blob::FindLine(void)
     return location > 0 ? std::optional<std::reference_wrapper<std::string>>{result} : std::nullopt;
 }
 
+#pragma mark -
+#pragma mark BufferPool
+
+class BufferPool::Storage
+{
+public:
+    Storage(int bufferSize, int count)
+    :_memory(new Byte[bufferSize * count])
+    {
+        // Reserve everything up front, so that returning things to the pool never allocates
+        _buffers.reserve(count);
+        _blocks.reserve(count);
+        for (int i = 0; i < count; i++)
+            _buffers.push_back(_memory.get() + (i * bufferSize));
+    }
+    
+    ~Storage()
+    {
+        for (void *block : _blocks)
+            ::operator delete(block);
+    }
+    
+    Byte* GetBuffer(void)
+    {
+        if (_buffers.empty())
+            return nullptr;
+        Byte *buffer = _buffers.back();
+        _buffers.pop_back();
+        return buffer;
+    }
+    
+    void ReturnBuffer(Byte *buffer)
+    {
+        _buffers.push_back(buffer);
+    }
+    
+    // The shared_ptr control blocks for pooled buffers are recycled too. They're all the same size, which is only
+    // known once the first one is requested.
+    void* GetBlock(size_t size)
+    {
+        if ((size == _blockSize) && !_blocks.empty()) {
+            void *block = _blocks.back();
+            _blocks.pop_back();
+            return block;
+        }
+        return ::operator new(size);
+    }
+    
+    void ReturnBlock(void *block, size_t size)
+    {
+        if (_blockSize == 0)
+            _blockSize = size;
+        if ((size == _blockSize) && (_blocks.size() < _blocks.capacity()))
+            _blocks.push_back(block);
+        else
+            ::operator delete(block);
+    }
+    
+private:
+    std::unique_ptr<Byte[]> _memory;
+    std::vector<Byte*> _buffers;
+    std::vector<void*> _blocks;
+    size_t _blockSize = 0;
+};
+
+namespace {
+    
+template<class T> class PoolAllocator
+{
+public:
+    using value_type = T;
+    
+    PoolAllocator(const std::shared_ptr<BufferPool::Storage>& storage)
+    :_storage(storage)
+    {
+    }
+    
+    template<class U> PoolAllocator(const PoolAllocator<U>& other)
+    :_storage(other._storage)
+    {
+    }
+    
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(_storage->GetBlock(count * sizeof(T)));
+    }
+    
+    void deallocate(T *block, size_t count)
+    {
+        _storage->ReturnBlock(block, count * sizeof(T));
+    }
+    
+    template<class U> bool operator==(const PoolAllocator<U>& other) const { return _storage == other._storage; }
+    template<class U> bool operator!=(const PoolAllocator<U>& other) const { return _storage != other._storage; }
+    
+    std::shared_ptr<BufferPool::Storage> _storage;
+};
+
+class PoolReturner
+{
+public:
+    PoolReturner(const std::shared_ptr<BufferPool::Storage>& storage)
+    :_storage(storage)
+    {
+    }
+    
+    void operator()(Byte *buffer) const
+    {
+        _storage->ReturnBuffer(buffer);
+    }
+    
+private:
+    std::shared_ptr<BufferPool::Storage> _storage;
+};
+
+} // namespace
+
+BufferPool::BufferPool(int bufferSize, int count)
+:_storage(std::make_shared<Storage>(bufferSize, count)), _bufferSize(bufferSize)
+{
+}
+
+Blob BufferPool::Get(void)
+{
+    Byte *buffer = _storage->GetBuffer();
+    if (!buffer) {
+        _misses++;
+        return Blob();
+    }
+    _hits++;
+    return Blob(std::shared_ptr<Byte>(buffer, PoolReturner(_storage), PoolAllocator<Byte>(_storage)), _bufferSize);
+}
+
 #pragma mark -
 #pragma mark Reader
 
 Reader::Reader(const Blob& data, int offset)
+:_data(data), _position(offset), _length(data.Length() - offset)
 {
-    _cursor = data.Value();
-    _length = data.Length();
-    
-    _cursor += offset;
-    _length -= offset;
 }
 
 Byte Reader::ReadByte(void)
 {
     Check(1);
     _length--;
-    return *(_cursor++);
+    return _data.Value()[_position++];
 }
 
 Blob Reader::ReadBytes(int length)
 {
     Check(length);
-    Blob result(_cursor, length);
-    _cursor += length;
+    Blob result = _data.Slice(_position, length);
+    _position += length;
     _length -= length;
     return result;
 }
@@ -238,8 +497,9 @@ bool Reader::ReadBoolean(void)
 UInt32 Reader::ReadUInt32(void)
 {
     Check(sizeof(UInt32));
-    UInt32 value = *(UInt32*)_cursor;
-    _cursor += sizeof(UInt32);
+    UInt32 value;
+    memcpy(&value, _data.Value() + _position, sizeof(value));
+    _position += sizeof(UInt32);
     _length -= sizeof(UInt32);
     return Swap32(value);
 }
@@ -247,8 +507,9 @@ UInt32 Reader::ReadUInt32(void)
 UInt64 Reader::ReadUInt64(void)
 {
     Check(sizeof(UInt64));
-    UInt64 value = *(UInt64*)_cursor;
-    _cursor += sizeof(UInt64);
+    UInt64 value;
+    memcpy(&value, _data.Value() + _position, sizeof(value));
+    _position += sizeof(UInt64);
     _length -= sizeof(UInt64);
     return Swap64(value);
 }
@@ -295,7 +556,7 @@ std::vector<std::string> Reader::ReadNameList(void)
 void Reader::SkipBytes(int length)
 {
     Check(length);
-    _cursor += length;
+    _position += length;
     _length -= length;
 }
 
@@ -315,7 +576,7 @@ void Writer::Write(Byte byte)
     _blob.Append(&byte, 1);
 }
 
-void Writer::Write(Blob bytes, int offset, int length)
+void Writer::Write(const Blob& bytes, int offset, int length)
 {
     if (length == -1)
         length = bytes.Length() - offset;
@@ -346,7 +607,7 @@ void Writer::Write(UInt64 value)
     _blob.Append((Byte*)&raw, sizeof(raw));
 }
 
-void Writer::WriteString(Blob string)
+void Writer::WriteString(const Blob& string)
 {
     Write((UInt32)string.Length());
     Write(string);
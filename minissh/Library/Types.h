@@ -35,13 +35,20 @@
 namespace minissh::Types {
 
 class Blob;
+class BufferPool;
 
+/**
+ * Reference counted byte buffer. Copies share the same storage, and a Blob may be a slice of a larger buffer, so
+ * passing one around or reading fields out of one doesn't copy any data. Storage is copied on write, if it's shared.
+ * Small contents are kept inline, so short messages don't need a heap allocation at all.
+ */
 class Blob
 {
 public:
     Blob();
     Blob(const Byte* data, int length);
     Blob(const Blob& other);
+    Blob(Blob&& other) noexcept;
     ~Blob();
 
     const Byte* Value(void) const;
@@ -54,27 +61,62 @@ public:
     Blob XorWith(const Blob& other) const;
     
     void DebugDump(void);
+    static UInt64 BytesCopied(void);    // Running total of bytes blobs have copied on this thread, for measuring
     
-    Blob& operator=(Blob other)
-    {
-        std::swap(_max, other._max);
-        std::swap(_len, other._len);
-        std::swap(_value, other._value);
-        return *this;
-    }
+    Blob& operator=(Blob other);
     
     // Mutability
     void Reset(void);
     void Append(const Byte *bytes, int length);
     void Strip(int location, int length);
+    Byte* MutableValue(void);   // Pointer to writable contents, unsharing them first if necessary
     Blob Copy(void) const;
+    
+    // Sharing
+    Blob Slice(int offset, int length) const;   // Subrange of this blob, sharing the same storage
 
     // Utility
     std::optional<std::string> FindLine(void);
 
 private:
-    Byte *_value;
-    int _len, _max;
+    friend BufferPool;
+    
+    static constexpr int InlineSize = 64;   // Enough for window adjusts, channel requests and the like
+    
+    std::shared_ptr<Byte> _buffer;  // Null while the contents fit in _inline
+    int _offset, _len, _max;
+    Byte _inline[InlineSize];
+    
+    Blob(const std::shared_ptr<Byte>& buffer, int size);
+    
+    Byte* Storage(void) const;
+    bool Contains(const Byte *bytes) const;
+    bool Shared(void) const;
+    void Reallocate(int size, const Byte *extra, int extraLength);
+};
+
+/**
+ * A slab of fixed size buffers for Blobs, each returned to the pool once the last Blob using it has gone. A transport
+ * can be given one so that steady state packet handling reuses the same memory rather than allocating per packet.
+ */
+class BufferPool
+{
+public:
+    BufferPool(int bufferSize, int count);
+    
+    Blob Get(void);     // An empty blob, backed by a pooled buffer if one is free
+    
+    int BufferSize(void) const { return _bufferSize; }
+    UInt64 Hits(void) const { return _hits; }       // Number of Get calls that were given a pooled buffer
+    UInt64 Misses(void) const { return _misses; }   // Number of Get calls that found the pool exhausted
+    
+    // Internal
+    class Storage;
+    
+private:
+    std::shared_ptr<Storage> _storage;  // Shared with the buffers handed out, so it can outlive the pool
+    int _bufferSize;
+    UInt64 _hits = 0, _misses = 0;
 };
 
 class Reader
@@ -95,7 +137,8 @@ public:
     int Remaining(void) { return _length; }
     
 private:
-    const Byte *_cursor;
+    Blob _data; // Retained so that strings/bytes read can be returned as slices of it
+    int _position;
     int _length;
     
     void Check(size_t length);
@@ -107,12 +150,12 @@ public:
     Writer(Blob& output);
     
     void Write(Byte byte);
-    void Write(Blob bytes, int offset = 0, int length = -1); // Unlike WriteString, this does not write length, merely appending the bytes
+    void Write(const Blob& bytes, int offset = 0, int length = -1); // Unlike WriteString, this does not write length, merely appending the bytes
     void Write(const std::string& str); // Unlike WriteString, this does not write length, but appends the string
     void Write(bool boolean);
     void Write(UInt32 value);
     void Write(UInt64 value);
-    void WriteString(Blob string);
+    void WriteString(const Blob& string);
     void WriteString(const std::string& string);
     void Write(const Maths::BigNumber& value);
     void Write(const std::vector<std::string>& nameList);
@@ -13,7 +13,7 @@
 namespace minissh::HMAC {
 
 // RFC2104: hash(K ^ opad, hash(k ^ ipad, text))
-Types::Blob Calculate(const Hash::AType& hash, Types::Blob key, Types::Blob text)
+Types::Blob Calculate(const Hash::AType& hash, Types::Blob key, const Types::Blob& text)
 {
     // If key is longer than 64 bytes, hash it
     if (key.Length() > 64) {
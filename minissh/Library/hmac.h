@@ -17,6 +17,6 @@ namespace minissh::HMAC {
 /**
  * Generate an HMAC.
  */
-Types::Blob Calculate(const Hash::AType& hash, Types::Blob key, Types::Blob text);
+Types::Blob Calculate(const Hash::AType& hash, Types::Blob key, const Types::Blob& text);
 
 } // namespace minissh::HMAC
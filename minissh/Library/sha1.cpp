@@ -135,7 +135,7 @@ void SHA1_Transform(minissh::UInt32 state[5], const minissh::Byte buffer[64])
     CHAR64LONG16* block;
     
 #ifdef SHA1HANDSOFF
-    static minissh::Byte workspace[64];
+    minissh::Byte workspace[64];   // On the stack rather than static, so hashing is safe from several threads at once
     block = (CHAR64LONG16*)workspace;
     memcpy(block, buffer, 64);
 #else
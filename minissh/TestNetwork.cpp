@@ -106,6 +106,8 @@ void Socket::OnEvent(void)
 {
     char buf[1024];
     int res = (int)recv(_fd, buf, sizeof(buf), 0);
+    if ((res <= 0) && onDisconnect)
+        onDisconnect();
     if (res == -1) {
         fprintf(stderr, "Error reading\n");
         exit(-3);
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <functional>
 #include "Client.h"
 #include "RSA.h"
 
@@ -45,6 +46,7 @@ public:
     
     minissh::Transport::Transport *transport;
     std::shared_ptr<minissh::RSA::KeySet> hostKey;
+    std::function<void(void)> onDisconnect;     // Called when the connection is closed or fails
     
 protected:
     void OnEvent(void) override;
@@ -14,21 +14,22 @@
 
 void ConfigureSSH(minissh::Transport::Configuration& sshConfiguration)
 {
+    // Added in order of preference
     minissh::Algorithms::DiffieHellman::Group14::Factory::Add(sshConfiguration.supportedKeyExchanges);
     minissh::Algorithms::DiffieHellman::Group1::Factory::Add(sshConfiguration.supportedKeyExchanges);
     minissh::Algoriths::SSH_RSA::Factory::Add(sshConfiguration.serverHostKeyAlgorithms);
-    minissh::Algorithm::AES128_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
-    minissh::Algorithm::AES128_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
-    //minissh::Algorithm::AES192_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
-    //minissh::Algorithm::AES192_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
-    //minissh::Algorithm::AES256_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
-    //minissh::Algorithm::AES256_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
     minissh::Algorithm::AES128_CTR::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
     minissh::Algorithm::AES128_CTR::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
-    //minissh::Algorithm::AES192_CTR::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
-    //minissh::Algorithm::AES192_CTR::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
-    //minissh::Algorithm::AES256_CTR::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
-    //minissh::Algorithm::AES256_CTR::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
+    minissh::Algorithm::AES192_CTR::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
+    minissh::Algorithm::AES192_CTR::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
+    minissh::Algorithm::AES256_CTR::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
+    minissh::Algorithm::AES256_CTR::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
+    minissh::Algorithm::AES128_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
+    minissh::Algorithm::AES128_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
+    minissh::Algorithm::AES192_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
+    minissh::Algorithm::AES192_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
+    minissh::Algorithm::AES256_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_clientToServer);
+    minissh::Algorithm::AES256_CBC::Factory::Add(sshConfiguration.encryptionAlgorithms_serverToClient);
     minissh::Algorithm::HMAC_SHA1::Factory::Add(sshConfiguration.macAlgorithms_clientToServer);
     minissh::Algorithm::HMAC_SHA1::Factory::Add(sshConfiguration.macAlgorithms_serverToClient);
     minissh::Transport::NoneCompression::Factory::Add(sshConfiguration.compressionAlgorithms_clientToServer);
@@ -0,0 +1,548 @@
+//
+//  benchmark.cpp
+//  minibench
+//
+//  Copyright © 2020 MICE Software. All rights reserved.
+//
+
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include "Server.h"
+#include "Client.h"
+#include "Connection.h"
+#include "SshAuth.h"
+#include "RSA.h"
+#include "Maths.h"
+#include "SlidingWindow.h"
+
+#include "TestUtils.h"
+
+// Every operator new in the process is counted, so the cost of a piece of work is the difference across it
+static minissh::UInt64 allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    allocations++;
+    void *result = malloc(size ? size : 1);
+    if (!result)
+        throw std::bad_alloc();
+    return result;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t size) noexcept
+{
+    free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t size) noexcept
+{
+    free(pointer);
+}
+
+namespace {
+
+/**
+ * Fixed sequence random source, so that runs can be compared with each other. Not for anything but benchmarking.
+ */
+class BenchRandom : public minissh::Maths::IRandomSource
+{
+public:
+    BenchRandom(minissh::UInt64 seed)
+    :_state(seed)
+    {
+    }
+
+    minissh::UInt32 Random(void) override
+    {
+        _state ^= _state << 13;
+        _state ^= _state >> 7;
+        _state ^= _state << 17;
+        return minissh::UInt32(_state >> 32);
+    }
+
+private:
+    minissh::UInt64 _state;
+};
+
+// Seconds per call of a piece of work. It's repeated until enough time has passed to trust the clock, and the best of a
+// few such runs is taken, so that other activity on the machine gets in the way as little as possible.
+template<class Work> double Time(Work work)
+{
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        int calls = 0;
+        double elapsed;
+        do {
+            work();
+            calls++;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (elapsed < 0.05);
+        if ((run == 0) || ((elapsed / calls) < best))
+            best = elapsed / calls;
+    }
+    return best;
+}
+
+// A random number of exactly this many bits
+minissh::Maths::BigNumber RandomNumber(minissh::Maths::IRandomSource& random, int bits)
+{
+    minissh::Maths::BigNumber result(bits, random);
+    result.SetBit(bits - 1);
+    return result;
+}
+
+/**
+ * One end of the loopback, collecting whatever its transport sends until the other end is given it.
+ */
+class Pipe : public minissh::Transport::Transport::IDelegate
+{
+public:
+    std::vector<minissh::Byte> pending, delivering;  // Swapped rather than reallocated, so the pipe itself doesn't allocate
+    std::shared_ptr<minissh::RSA::KeySet> hostKey;
+    int packets = 0;
+
+    void Send(const void *data, minissh::UInt32 length) override
+    {
+        // Each packet goes out in a single call
+        packets++;
+        pending.insert(pending.end(), (const minissh::Byte*)data, (const minissh::Byte*)data + length);
+    }
+
+    void Failed(minissh::Transport::Transport::PanicReason reason) override
+    {
+        throw std::runtime_error(minissh::Transport::Transport::StringForPanicReason(reason));
+    }
+
+    std::shared_ptr<minissh::Files::Format::IKeyFile> GetHostKey(void) override
+    {
+        return hostKey;
+    }
+};
+
+class EchoChannel : public minissh::Core::Connection::Connection::AChannel
+{
+public:
+    EchoChannel(minissh::Core::Connection::Connection& owner):AChannel(owner){}
+
+    class Provider : public minissh::Core::Connection::Connection::IChannelProvider
+    {
+    public:
+        std::shared_ptr<AChannel> AcceptChannel(minissh::Core::Connection::Connection& owner, std::string channelType, minissh::Types::Blob extraData) override
+        {
+            return std::make_shared<EchoChannel>(owner);
+        }
+    };
+
+protected:
+    OpenChannelInfo OpenInfo(OpenChannelParameters& parameters) override
+    {
+        return {};
+    }
+
+    void ReceivedData(const minissh::Types::Blob& data) override
+    {
+        Send(data);
+    }
+
+    void ReceivedExtendedData(minissh::UInt32 type, const minissh::Types::Blob& data) override {}
+    bool ReceivedRequest(const std::string& request, std::optional<minissh::Types::Blob> data) override { return true; }
+};
+
+class SessionChannel : public minissh::Core::Connection::Connection::AChannel
+{
+public:
+    SessionChannel(minissh::Core::Connection::Connection& owner):AChannel(owner){}
+
+    bool opened = false;
+    int received = 0;   // Bytes echoed back
+
+    void Send(const minissh::Types::Blob& data)
+    {
+        AChannel::Send(data);
+    }
+
+protected:
+    OpenChannelInfo OpenInfo(OpenChannelParameters& parameters) override
+    {
+        return {std::nullopt, "session"};
+    }
+
+    void Opened(const minissh::Types::Blob& data) override
+    {
+        opened = true;
+    }
+
+    void ReceivedData(const minissh::Types::Blob& data) override
+    {
+        received += data.Length();
+    }
+
+    void ReceivedExtendedData(minissh::UInt32 type, const minissh::Types::Blob& data) override {}
+};
+
+class ServerAuthenticator : public minissh::Server::IAuthenticator
+{
+public:
+    std::optional<bool> ConfirmPassword(std::string requestedService, std::string username, std::string password) override { return true; }
+    bool ConfirmPasswordWithNew(std::string requestedService, std::string username, std::string password, std::string newPassword) override { return false; }
+    bool ConfirmKnownPublicKey(std::string requestedService, std::string username, std::string keyAlgorithm, minissh::Types::Blob publicKey) override { return false; }
+    PublicKeyData GetPublicKeyAlgorithm(std::string username, std::string keyAlgorithm, minissh::Types::Blob publicKey) override { return {}; }
+};
+
+class ClientAuthenticator : public minissh::Client::IAuthenticator
+{
+public:
+    void Banner(Replier& replier, const std::string& message, const std::string& languageTag) override {}
+
+    void Query(Replier& replier, const std::optional<std::vector<std::string>>& acceptedModes, bool partiallyAccepted) override
+    {
+        if (!acceptedModes)
+            replier.SendNone("bench");
+        else
+            replier.SendPassword("bench", "bench");
+    }
+
+    void NeedChangePassword(Replier& replier, const std::string& prompt, const std::string& languageTag) override {}
+    void AcceptablePublicKey(Replier& replier, const std::string& keyAlgorithm, minissh::Types::Blob publicKey) override {}
+};
+
+/**
+ * A client and a server wired directly to each other, so a whole session runs in one thread without any sockets.
+ */
+class Loopback
+{
+public:
+    Loopback(std::shared_ptr<minissh::RSA::KeySet> hostKey)
+    :_serverRandom(1), _clientRandom(2)
+    ,_server(_serverRandom), _serverAuth(_server, _server.DefaultServiceHandler(), _serverAuthenticator), _serverConnection(_server, _serverAuth.AuthServiceHandler())
+    ,_client(_clientRandom), _clientAuth(_client, _client.DefaultEnabler()), _clientConnection(_client, Enable(_clientAuth, _clientAuthenticator))
+    {
+        _serverPipe.hostKey = hostKey;
+        _server.SetDelegate(&_serverPipe);
+        _client.SetDelegate(&_clientPipe);
+        ConfigureSSH(_server.configuration);
+        ConfigureSSH(_client.configuration);
+        _serverConnection.RegisterChannelType("session", std::make_shared<EchoChannel::Provider>());
+        session = std::make_shared<SessionChannel>(_clientConnection);
+        _clientConnection.OpenChannel(session);
+    }
+
+    void Start(void)
+    {
+        _server.Start();
+        _client.Start();
+        Run();
+        if (!session->opened)
+            throw std::runtime_error("Loopback session didn't open");
+    }
+
+    // Hand each side what the other has sent, until both are quiet
+    void Run(void)
+    {
+        while (!_clientPipe.pending.empty() || !_serverPipe.pending.empty()) {
+            Deliver(_clientPipe, _server);
+            Deliver(_serverPipe, _client);
+        }
+    }
+
+    int Packets(void) const
+    {
+        return _clientPipe.packets + _serverPipe.packets;
+    }
+
+    std::shared_ptr<SessionChannel> session;
+
+private:
+    BenchRandom _serverRandom, _clientRandom;
+    Pipe _serverPipe, _clientPipe;
+    ServerAuthenticator _serverAuthenticator;
+    ClientAuthenticator _clientAuthenticator;
+    minissh::Core::Server _server;
+    minissh::Server::AuthService _serverAuth;
+    minissh::Core::Connection::Server _serverConnection;
+    minissh::Core::Client _client;
+    minissh::Client::AuthService _clientAuth;
+    minissh::Core::Connection::Client _clientConnection;
+
+    static std::shared_ptr<minissh::Core::Client::IEnabler> Enable(minissh::Client::AuthService& service, minissh::Client::IAuthenticator& authenticator)
+    {
+        // The client connection needs the enabler from the start, and that needs the authenticator
+        service.SetAuthenticator(&authenticator);
+        return service.AuthEnabler();
+    }
+
+    static void Deliver(Pipe& from, minissh::Transport::Transport& to)
+    {
+        from.delivering.swap(from.pending);
+        if (!from.delivering.empty())
+            to.Received(from.delivering.data(), (minissh::UInt32)from.delivering.size());
+        from.delivering.clear();
+    }
+};
+
+std::shared_ptr<minissh::RSA::KeySet> HostKey(void)
+{
+    static std::shared_ptr<minissh::RSA::KeySet> key;
+    if (!key) {
+        BenchRandom random(3);
+        key = std::make_shared<minissh::RSA::KeySet>(random, 1024);
+    }
+    return key;
+}
+
+#pragma mark -
+
+void BenchAllocations(void)
+{
+    // Short messages, like keystrokes, are what most packets on an interactive session carry
+    const int messages = 1000;
+    const int messageSize = 16;
+
+    Loopback loopback(HostKey());
+    minissh::UInt64 start = allocations;
+    loopback.Start();
+    minissh::UInt64 handshake = allocations - start;
+    int handshakePackets = loopback.Packets();
+    printf("allocations: handshake and login, %d packets, %llu allocations, %.1f per packet\n", handshakePackets, (unsigned long long)handshake, double(handshake) / handshakePackets);
+
+    minissh::Types::Blob message;
+    for (int i = 0; i < messageSize; i++) {
+        minissh::Byte c = 'a' + i;
+        message.Append(&c, 1);
+    }
+    start = allocations;
+    for (int i = 0; i < messages; i++) {
+        loopback.session->Send(message);
+        loopback.Run();
+    }
+    minissh::UInt64 echo = allocations - start;
+    int echoPackets = loopback.Packets() - handshakePackets;
+    if (loopback.session->received != (messages * messageSize))
+        throw std::runtime_error("Loopback echo lost data");
+    printf("allocations: %d byte messages echoed, %d packets, %llu allocations, %.1f per packet\n", messageSize, echoPackets, (unsigned long long)echo, double(echo) / echoPackets);
+}
+
+void BenchCopies(void)
+{
+    // Each payload goes from the client to the server's channel, which sends it straight back. The total is kept within
+    // the channel's initial window, so that flow control doesn't come into it.
+    Loopback loopback(HostKey());
+    loopback.Start();
+    for (int messageSize : {16, 1024}) {
+        int messages = std::min(200, 32768 / messageSize);
+        std::vector<minissh::Byte> bytes(messageSize);
+        for (int i = 0; i < messageSize; i++)
+            bytes[i] = minissh::Byte(i);
+        minissh::Types::Blob message(bytes.data(), messageSize);
+        int received = loopback.session->received;
+        minissh::UInt64 start = minissh::Types::Blob::BytesCopied();
+        for (int i = 0; i < messages; i++) {
+            loopback.session->Send(message);
+            loopback.Run();
+        }
+        minissh::UInt64 copied = minissh::Types::Blob::BytesCopied() - start;
+        if ((loopback.session->received - received) != (messages * messageSize))
+            throw std::runtime_error("Loopback echo lost data");
+        printf("copies: %d byte payloads echoed, %.0f bytes copied by blobs per payload, %.1f per payload byte\n", messageSize, double(copied) / messages, double(copied) / (double(messages) * messageSize));
+    }
+}
+
+void BenchPowerMod(void)
+{
+    // Averaged over several exponents, as the counts depend on the bit pattern. The binary columns are the plain
+    // right to left method, which squares for every bit and multiplies for every set one.
+    const int exponents = 20;
+
+    BenchRandom random(4);
+    printf("powmod: bits  window  squarings  multiplications  total  (binary: squarings  multiplications  total)  ms\n");
+    for (int bits : {160, 224, 512, 1024, 2048, 4096}) {
+        double squarings = 0, multiplications = 0, setBits = 0;
+        int window = 0;
+        for (int i = 0; i < exponents; i++) {
+            minissh::Maths::BigNumber exponent = RandomNumber(random, bits);
+            // The library's own scan, counting instead of multiplying, plus building the table of odd powers
+            window = minissh::Maths::WindowSize(exponent.BitLength());
+            int tableSize = 1 << (window - 1);
+            if (tableSize > 1) {
+                squarings++;
+                multiplications += tableSize - 1;
+            }
+            minissh::Maths::SlidingWindow(exponent, window, [&]{ squarings++; }, [](int){}, [&](int){ multiplications++; });
+            for (int bit = 0; bit < bits; bit++)
+                setBits += exponent[bit] ? 1 : 0;
+        }
+        squarings /= exponents;
+        multiplications /= exponents;
+        setBits /= exponents;
+        minissh::Maths::BigNumber modulus = RandomNumber(random, bits);
+        modulus.SetBit(0);
+        minissh::Maths::BigNumber base = RandomNumber(random, bits - 1), exponent = RandomNumber(random, bits);
+        double seconds = Time([&]{ base.PowerMod(exponent, modulus); });
+        printf("powmod: %4d  %6d  %9.0f  %15.0f  %5.0f  (        %9d  %15.0f  %5.0f)  %.3f\n", bits, window, squarings, multiplications, squarings + multiplications, bits, setBits, bits + setBits, seconds * 1000);
+    }
+}
+
+void BenchKaratsuba(void)
+{
+    // Each operation is timed with schoolbook only, then with Karatsuba from each threshold, so that the crossover can
+    // be read off for this machine. The threshold in use is starred.
+    const minissh::UInt32 thresholds[] = {8, 12, 16, 24, 32, 48, 64};
+    const minissh::UInt32 chosen = minissh::Maths::BigNumber::KaratsubaThreshold();
+
+    BenchRandom random(5);
+    for (bool square : {false, true}) {
+        printf("karatsuba: %s, microseconds; columns are schoolbook, then thresholds in digits of %d bits\n", square ? "n bit squares" : "n by n bit products", BIGNUMBER_DIGIT_BITS);
+        printf("karatsuba:  bits  school");
+        for (minissh::UInt32 threshold : thresholds)
+            printf("  %5d%c", threshold, (threshold == chosen) ? '*' : ' ');
+        printf("\n");
+        for (int bits : {1024, 1536, 2048, 3072, 4096, 6144, 8192}) {
+            minissh::Maths::BigNumber a = RandomNumber(random, bits), b = RandomNumber(random, bits);
+            auto work = [&]{ if (square) a.Square(); else a * b; };
+            minissh::Maths::BigNumber::SetKaratsubaThreshold(0x10000000);
+            printf("karatsuba: %5d  %6.2f", bits, Time(work) * 1e6);
+            for (minissh::UInt32 threshold : thresholds) {
+                minissh::Maths::BigNumber::SetKaratsubaThreshold(threshold);
+                printf("  %6.2f", Time(work) * 1e6);
+            }
+            printf("\n");
+        }
+    }
+    minissh::Maths::BigNumber::SetKaratsubaThreshold(chosen);
+}
+
+struct EuclideanResult
+{
+    minissh::Maths::BigNumber gcd, x, y;
+};
+
+// The extended Euclid the library used before Lehmer's algorithm, kept as a reference. That was recursive, which would
+// now overflow the stack as BigNumbers carry their digits inline, so this is the same steps as a loop: a division and a
+// remainder, and a multiplication for each cofactor, per quotient.
+EuclideanResult EuclideanGCD(const minissh::Maths::BigNumber& a, const minissh::Maths::BigNumber& b)
+{
+    // Each r is a * x + b * y
+    minissh::Maths::BigNumber r0 = b, r1 = a, x0 = 0, x1 = 1, y0 = 1, y1 = 0;
+    while (r1 != 0) {
+        minissh::Maths::BigNumber q = r0 / r1, r = r0 % r1;
+        minissh::Maths::BigNumber x = x0 - (q * x1), y = y0 - (q * y1);
+        r0 = r1;
+        r1 = r;
+        x0 = x1;
+        x1 = x;
+        y0 = y1;
+        y1 = y;
+    }
+    return {r0, x0, y0};
+}
+
+minissh::Maths::BigNumber EuclideanInverse(const minissh::Maths::BigNumber& a, const minissh::Maths::BigNumber& m)
+{
+    EuclideanResult result = EuclideanGCD(a, m);
+    if (result.gcd != 1)
+        throw std::runtime_error("Not reversible");
+    return (result.x % m + m) % m;
+}
+
+void BenchGCD(void)
+{
+    BenchRandom random(6);
+    printf("gcd: milliseconds for the extended GCD, and for ModularInverse with an odd modulus\n");
+    printf("gcd: bits  Euclid GCD  Lehmer GCD  Euclid inverse  Lehmer inverse\n");
+    for (int bits : {512, 1024, 2048, 4096}) {
+        minissh::Maths::BigNumber a = RandomNumber(random, bits), b = RandomNumber(random, bits), m = RandomNumber(random, bits);
+        m.SetBit(0);
+        while (a.GCD(m) != 1)
+            a += 1;
+        // Check the two agree before timing them
+        minissh::Maths::BigNumber x, y;
+        EuclideanResult reference = EuclideanGCD(a, b);
+        if ((a.GCD(b, x, y) != reference.gcd) || (((a * x) + (b * y)) != reference.gcd) || (a.ModularInverse(m) != EuclideanInverse(a, m)))
+            throw std::runtime_error("GCD results differ");
+        double euclid = Time([&]{ EuclideanGCD(a, b); });
+        double lehmer = Time([&]{ a.GCD(b, x, y); });
+        double euclidInverse = Time([&]{ EuclideanInverse(a, m); });
+        double lehmerInverse = Time([&]{ a.ModularInverse(m); });
+        printf("gcd: %4d  %10.3f  %10.3f  %14.3f  %14.3f\n", bits, euclid * 1000, lehmer * 1000, euclidInverse * 1000, lehmerInverse * 1000);
+    }
+}
+
+void BenchVerify(void)
+{
+    // Verify only takes the cached windowed path for exponents over 32 bits, and keys here use 65537, so that column is
+    // worked out from the cached Verify by swapping in the time of the windowed power.
+    BenchRandom random(7);
+    minissh::Hash::SHA1 hash;
+    minissh::Types::Blob message;
+    message.Append((const minissh::Byte*)"benchmark", 9);
+    printf("verify: SSA_PKCS1_V1_5::Verify per second with SHA-1, then s^e per second, by modulus bits\n");
+    printf("verify: bits  uncached  cached  cached window  (s^e: uncached  cached window  cached square and multiply)\n");
+    for (int bits : {1024, 2048, 4096}) {
+        minissh::RSA::KeySet keys(random, bits / 2);
+        const minissh::RSA::Key cached = keys.PublicKey();
+        const minissh::RSA::Key uncached(cached.n, cached.e);
+        minissh::Types::Blob signature = *minissh::RSA::SSA_PKCS1_V1_5::Sign(keys.PrivateKey(), message, hash);
+        if (!minissh::RSA::SSA_PKCS1_V1_5::Verify(uncached, message, signature, hash) || !minissh::RSA::SSA_PKCS1_V1_5::Verify(cached, message, signature, hash))
+            throw std::runtime_error("Signature didn't verify");
+        const minissh::Maths::BigNumber s(signature.Value(), signature.Length(), false);
+        const minissh::UInt32 e = minissh::UInt32(cached.e.AsUInt64());
+        double verifyUncached = Time([&]{ minissh::RSA::SSA_PKCS1_V1_5::Verify(uncached, message, signature, hash); });
+        double verifyCached = Time([&]{ minissh::RSA::SSA_PKCS1_V1_5::Verify(cached, message, signature, hash); });
+        double powerUncached = Time([&]{ s.PowerMod(cached.e, cached.n); });
+        double powerWindow = Time([&]{ cached.field->PowerMod(s, cached.e); });
+        double powerSquare = Time([&]{ cached.field->PowerMod(s, e); });
+        double verifyWindow = verifyCached - powerSquare + powerWindow;
+        printf("verify: %4d  %8.0f  %6.0f  %13.0f  (     %8.0f  %13.0f  %26.0f)\n", bits, 1 / verifyUncached, 1 / verifyCached, 1 / verifyWindow, 1 / powerUncached, 1 / powerWindow, 1 / powerSquare);
+    }
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)(void);
+};
+
+const Benchmark benchmarks[] = {
+    {"allocations", BenchAllocations},
+    {"copies", BenchCopies},
+    {"powmod", BenchPowerMod},
+    {"karatsuba", BenchKaratsuba},
+    {"gcd", BenchGCD},
+    {"verify", BenchVerify},
+};
+
+} // namespace
+
+int main(int argc, const char * argv[])
+{
+    // With no arguments everything runs, otherwise just the named benchmarks
+    for (const Benchmark& benchmark : benchmarks) {
+        bool wanted = argc < 2;
+        for (int i = 1; i < argc; i++)
+            if (strcmp(argv[i], benchmark.name) == 0)
+                wanted = true;
+        if (wanted)
+            benchmark.run();
+    }
+    return 0;
+}
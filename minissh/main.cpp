@@ -163,7 +163,7 @@ public:
         return {std::nullopt, "session"};
     }
     
-    void Opened(minissh::Types::Blob data) override
+    void Opened(const minissh::Types::Blob& data) override
     {
         minissh::Types::Blob parameters;
         minissh::Types::Writer writer(parameters);
@@ -199,14 +199,14 @@ public:
         printf("Session closed\n");
     }
     
-    void ReceivedData(minissh::Types::Blob data) override
+    void ReceivedData(const minissh::Types::Blob& data) override
     {
         for (int i = 0; i < data.Length(); i++)
             printf("%c", data.Value()[i]);
         fflush(stdout);
     }
     
-    void ReceivedExtendedData(minissh::UInt32 type, minissh::Types::Blob data) override
+    void ReceivedExtendedData(minissh::UInt32 type, const minissh::Types::Blob& data) override
     {
         for (int i = 0; i < data.Length(); i++)
             printf("%c", data.Value()[i]);
@@ -262,6 +262,7 @@ int main(int argc, const char * argv[])
     minissh::Core::Client client(randomiser);
     test->transport = &client;
     ConfigureSSH(test->transport->configuration);
+    test->transport->configuration.RankByBenchmark(randomiser);     // The client's order is the one that counts
     test->transport->SetDelegate(test);
     minissh::Client::AuthService *auth = new minissh::Client::AuthService(client, client.DefaultEnabler());
     auth->SetAuthenticator(&testAuth);
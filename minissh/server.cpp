@@ -37,7 +37,7 @@ protected:
         return {};
     }
     
-    void Opened(minissh::Types::Blob data) override
+    void Opened(const minissh::Types::Blob& data) override
     {
         minissh::Types::Blob test;
         minissh::Types::Writer writer(test);
@@ -45,7 +45,7 @@ protected:
         Send(test);
     }
     
-    void ReceivedData(minissh::Types::Blob data) override
+    void ReceivedData(const minissh::Types::Blob& data) override
     {
         minissh::Types::Blob test;
         minissh::Types::Writer writer(test);
@@ -55,7 +55,7 @@ protected:
         Send(test);
     }
     
-    void ReceivedExtendedData(minissh::UInt32 type, minissh::Types::Blob data) override {}
+    void ReceivedExtendedData(minissh::UInt32 type, const minissh::Types::Blob& data) override {}
     bool ReceivedRequest(const std::string& request, std::optional<minissh::Types::Blob> data) override
     {
         printf("Request %s received", request.c_str());
@@ -69,15 +69,19 @@ protected:
 class Client : public minissh::Server::IAuthenticator
 {
 public:
-    Client(minissh::Maths::IRandomSource& randomiser, std::shared_ptr<Socket> connection)
+    Client(minissh::Maths::IRandomSource& randomiser, std::shared_ptr<Socket> connection, std::shared_ptr<const minissh::Transport::SharedConfiguration> configuration)
     :_network(connection)
     ,_server(randomiser)
     ,_auth(_server, _server.DefaultServiceHandler() ,*this)
     ,_connection(_server, _auth.AuthServiceHandler())
     {
         _network->transport = &_server;
+        _network->onDisconnect = [this]{
+            printf("Buffer pool: %llu hits, %llu misses\n", (unsigned long long)_server.bufferPool->Hits(), (unsigned long long)_server.bufferPool->Misses());
+        };
         _server.SetDelegate(_network.get());
-        ConfigureSSH(_server.configuration);
+        _server.SetConfiguration(configuration);
+        _server.bufferPool = std::make_shared<minissh::Types::BufferPool>(4096, 8);     // Enough for a packet each way and a few in flight
         _connection.RegisterChannelType("session", std::make_shared<SessionServer::Provider>());
         _server.Start();
     }
@@ -120,6 +124,10 @@ public:
     Server(minissh::Maths::IRandomSource& randomiser, int port)
     :Listener(port), _randomiser(randomiser)
     {
+        minissh::Transport::Configuration configuration;
+        ConfigureSSH(configuration);
+        configuration.RankByBenchmark(_randomiser);
+        _configuration = std::make_shared<minissh::Transport::SharedConfiguration>(configuration);
         fprintf(stdout, "Generating host key...");
         fflush(stdout);
         _hostKey = std::make_shared<minissh::RSA::KeySet>(_randomiser, 1024);
@@ -129,11 +137,12 @@ public:
     void OnAccepted(std::shared_ptr<Socket> connection) override
     {
         connection->hostKey = _hostKey;
-        new Client(_randomiser, connection);
+        new Client(_randomiser, connection, _configuration);
     }
 private:
     minissh::Maths::IRandomSource &_randomiser;
     std::shared_ptr<minissh::RSA::KeySet> _hostKey;
+    std::shared_ptr<const minissh::Transport::SharedConfiguration> _configuration;  // Built once, for all connections
 };
 
 int main(int argc, const char * argv[])